@@ -78,6 +78,14 @@ extern "C" {
 			struct hid_device_info *next;
 		};
 
+		/** hidapi VID/PID pair, see hid_enumerate_ids() */
+		struct hid_device_id {
+			/** Device Vendor ID, 0 for any vendor */
+			unsigned short vendor_id;
+			/** Device Product ID, 0 for any product */
+			unsigned short product_id;
+		};
+
 
 		/** @brief Initialize the HIDAPI library.
 
@@ -131,6 +139,24 @@ extern "C" {
 		*/
 		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate(unsigned short vendor_id, unsigned short product_id);
 
+		/** @brief Enumerate the HID Devices matching a table of VID/PID pairs.
+
+			Same as hid_enumerate(), but the devices are matched against
+			all the pairs of @p ids in a single walk of the bus.
+
+			@ingroup API
+			@param ids The VID/PID pairs of the devices to return. A 0
+				in a pair matches any vendor or product.
+			@param num_ids The number of pairs in @p ids.
+
+		    @returns
+		    	This function returns a pointer to a linked list of type
+		    	struct #hid_device, or NULL if no device matched or in the
+		    	case of failure. Free this linked list by calling
+		    	hid_free_enumeration().
+		*/
+		struct hid_device_info HID_API_EXPORT * HID_API_CALL hid_enumerate_ids(const struct hid_device_id *ids, size_t num_ids);
+
 		/** @brief Free an enumeration Linked List
 
 		    This function frees a linked list created by hid_enumerate().
@@ -243,6 +269,31 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_read(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Read several Input reports from a HID device.
+
+			Wait like hid_read_timeout() for a first report, then
+			return it along with the reports already queued, up to
+			@p count, without waiting again. This drains a burst of
+			reports in one call.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer of @p count * @p length bytes. Report
+				i is put at @p data + i * @p length.
+			@param length The size of the buffer of each report.
+			@param lengths An array of @p count sizes, set to the
+				number of bytes read for each report.
+			@param count The maximum number of reports to read.
+			@param milliseconds timeout in milliseconds or -1 for
+				blocking wait, for the first report.
+
+			@returns
+				This function returns the number of reports read and
+				-1 on error. If no report was available to be read
+				within the timeout period, this function returns 0.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_read_many(hid_device *device, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds);
+
 		/** @brief Set the device handle to be non-blocking.
 
 			In non-blocking mode calls to hid_read() will return
@@ -263,6 +314,22 @@ extern "C" {
 		*/
 		int  HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *device, int nonblock);
 
+		/** @brief Get the number of Input reports dropped by a device.
+
+			Input reports are queued until they are read. When the
+			queue is full, the reports received are dropped.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the number of Input reports
+				dropped since the device was opened, or -1 if the
+				backend can't tell (the operating system does the
+				queuing).
+		*/
+		long HID_API_EXPORT HID_API_CALL hid_get_input_overflows(hid_device *device);
+
 		/** @brief Send a Feature report to the device.
 
 			Feature reports are sent over the Control endpoint as a
@@ -312,6 +379,157 @@ extern "C" {
 		*/
 		int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *device, unsigned char *data, size_t length);
 
+		/** @brief Completion callback of an asynchronous feature report.
+
+			@ingroup API
+			@param device The device the report was exchanged with, or
+				NULL if it was closed before the completion was reported.
+			@param res The number of bytes transferred, including the
+				report number, or -1 on error.
+			@param data The buffer given when the transfer was submitted.
+				For hid_get_feature_report_async() it holds the report read.
+			@param user_data The pointer given when the transfer was
+				submitted.
+		*/
+		typedef void (HID_API_CALL *hid_feature_report_cb)(hid_device *device, int res, unsigned char *data, void *user_data);
+
+		/** @brief Send a Feature report to the device, without waiting
+			for the transfer to complete.
+
+			The completion is reported to @p callback from
+			hid_handle_events(). @p data must stay valid until then.
+			This is only supported by the libusb implementation.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data The data to send, including the report number as
+				the first byte.
+			@param length The length in bytes of the data to send, including
+				the report number.
+			@param callback Called when the transfer is complete.
+			@param user_data Passed to @p callback.
+
+			@returns
+				This function returns 0 if the transfer has been
+				submitted and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_send_feature_report_async(hid_device *device, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data);
+
+		/** @brief Get a feature report from a HID device, without waiting
+			for the transfer to complete.
+
+			The completion is reported to @p callback from
+			hid_handle_events(), with the report read into @p data.
+			@p data must stay valid until then.
+			This is only supported by the libusb implementation.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+			@param data A buffer to put the read data into, including
+				the Report ID. Set the first byte of @p data[] to the
+				Report ID of the report to be read.
+			@param length The number of bytes to read, including an
+				extra byte for the report ID.
+			@param callback Called when the transfer is complete.
+			@param user_data Passed to @p callback.
+
+			@returns
+				This function returns 0 if the transfer has been
+				submitted and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_feature_report_async(hid_device *device, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data);
+
+		/** @brief Report the completed asynchronous transfers.
+
+			Calls the callbacks of all the asynchronous transfers
+			that have completed, and of the hotplug events received,
+			from the calling thread.
+
+			@ingroup API
+			@param milliseconds time to wait for a completion, -1 for
+				blocking mode, 0 to return immediately.
+
+			@returns
+				This function returns the number of callbacks called
+				and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_handle_events(int milliseconds);
+
+		/** @brief Get a file descriptor that becomes readable when
+			asynchronous transfers have completed.
+
+			It can be added to the caller's own poll()/select() loop,
+			hid_handle_events(0) is then called when it is readable.
+
+			@ingroup API
+
+			@returns
+				This function returns the file descriptor, or -1 if
+				asynchronous transfers are not supported.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_event_fd(void);
+
+		/** @brief Get the file descriptor of a device.
+
+			It becomes readable when an Input report can be read, so
+			that many devices can be waited for in a single poll() or
+			epoll_wait() loop. It must not be read from or closed
+			directly, hid_read_many() reads the reports.
+
+			@ingroup API
+			@param device A device handle returned from hid_open().
+
+			@returns
+				This function returns the file descriptor, or -1 if
+				the backend has no descriptor per device.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_get_fd(hid_device *device);
+
+		/** Event given to a hid_hotplug_cb when a device is plugged in. */
+		#define HID_HOTPLUG_ARRIVED 1
+		/** Event given to a hid_hotplug_cb when a device is unplugged. */
+		#define HID_HOTPLUG_LEFT    2
+
+		/** @brief Hotplug callback.
+
+			@ingroup API
+			@param event HID_HOTPLUG_ARRIVED or HID_HOTPLUG_LEFT.
+			@param devs The interfaces of the device, as they would be
+				returned by hid_enumerate(). For HID_HOTPLUG_LEFT the
+				device is gone already, so only the path is sure to be
+				filled in. The list is freed once the callback returns.
+			@param user_data The pointer given to hid_hotplug_register().
+		*/
+		typedef void (HID_API_CALL *hid_hotplug_cb)(int event, struct hid_device_info *devs, void *user_data);
+
+		/** @brief Get notified when devices are plugged in or unplugged.
+
+			The events are reported to @p callback from
+			hid_handle_events(), which must then be called regularly.
+			Only one callback can be registered at a time, a new
+			registration replaces the previous one. This is only
+			supported by the libusb and Linux/hidraw implementations.
+
+			@ingroup API
+			@param ids Table of VID/PID pairs to be notified of, as for
+				hid_enumerate_ids(). Departures may be reported for
+				other devices when the implementation can no longer
+				tell their VID/PID.
+			@param num_ids The number of entries in @p ids.
+			@param callback Called for every arrival and departure.
+			@param user_data Passed to @p callback.
+
+			@returns
+				This function returns 0 on success and -1 on error.
+		*/
+		int HID_API_EXPORT HID_API_CALL hid_hotplug_register(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data);
+
+		/** @brief Stop the notifications set up by hid_hotplug_register().
+
+			@ingroup API
+		*/
+		void HID_API_EXPORT HID_API_CALL hid_hotplug_deregister(void);
+
 		/** @brief Close a HID device.
 
 			@ingroup API
@@ -40,6 +40,7 @@
 #include <sys/ioctl.h>
 #include <sys/utsname.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
 #include <wchar.h>
 
@@ -71,12 +72,15 @@ libusb HIDAPI programs are encouraged to use the interface number
 instead to differentiate between interfaces on a composite HID device. */
 /*#define INVASIVE_GET_USAGE*/
 
-/* Linked List of input reports received from the device. */
-struct input_report {
-	uint8_t *data;
-	size_t len;
-	struct input_report *next;
-};
+/* Number of input reports queued by a device, a power of 2. Reports
+   received while the queue is full are dropped, and counted. */
+#ifndef HID_INPUT_REPORTS
+#define HID_INPUT_REPORTS 32
+#endif
+
+#if (HID_INPUT_REPORTS & (HID_INPUT_REPORTS - 1)) != 0
+#error HID_INPUT_REPORTS must be a power of 2
+#endif
 
 
 struct hid_device_ {
@@ -99,21 +103,92 @@ struct hid_device_ {
 	/* Whether blocking reads are used */
 	int blocking; /* boolean */
 
-	/* Read thread objects */
-	pthread_t thread;
-	pthread_mutex_t mutex; /* Protects input_reports */
+	/* Input transfer, handled by event_thread */
+	pthread_mutex_t mutex; /* Protects the flags */
 	pthread_cond_t condition;
-	pthread_barrier_t barrier; /* Ensures correct startup sequence */
-	int shutdown_thread;
-	int cancelled;
+	int shutdown_thread; /* the transfer is not submitted again */
+	int cancelled; /* the transfer has ended */
 	struct libusb_transfer *transfer;
 
-	/* List of received input reports. */
-	struct input_report *input_reports;
+	/* Ring of received input reports, in HID_INPUT_REPORTS slots of
+	   input_ep_max_packet_size bytes. read_callback() is the only
+	   producer and moves input_head, the reader is the only consumer
+	   and moves input_tail, so neither takes the mutex. */
+	unsigned char *input_data;
+	size_t input_len[HID_INPUT_REPORTS];
+	unsigned int input_head;
+	unsigned int input_tail;
+	unsigned long input_overflows;
+
+	/* Asynchronous feature reports submitted and not completed yet,
+	   protected by async_mutex. */
+	struct async_report *async_pending;
+};
+
+/* Asynchronous feature report transfer. */
+struct async_report {
+	hid_device *dev;
+	struct libusb_transfer *transfer;
+	unsigned char *data; /* caller's buffer, including the report ID */
+	size_t length;
+	int skipped_report_id;
+	int is_input;
+	int res;
+	hid_feature_report_cb callback;
+	void *user_data;
+	struct async_report *next; /* in dev->async_pending, then in async_completed */
 };
 
 static libusb_context *usb_context = NULL;
 
+/* Completed asynchronous transfers, waiting for hid_handle_events().
+   async_pipe is written once per completion so that callers can wait
+   on async_pipe[0]. */
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct async_report *async_completed = NULL;
+static int async_pipe[2] = { -1, -1 };
+/* Signalled on each completion, for hid_close() to wait for the
+   transfers of the device. */
+static pthread_cond_t async_cond = PTHREAD_COND_INITIALIZER;
+
+/* Hotplug event, waiting for hid_handle_events() like the completions. */
+struct hotplug_event {
+	libusb_device *device; /* referenced until reported */
+	int event;
+	struct hotplug_event *next;
+};
+
+/* Hotplug registration, protected by async_mutex. libusb only calls the
+   hotplug callbacks while its events are handled, so the registration
+   keeps event_thread running. */
+static int hotplug_registered = 0;
+static libusb_hotplug_callback_handle hotplug_handle;
+static struct hid_device_id *hotplug_ids = NULL;
+static size_t hotplug_num_ids = 0;
+static hid_hotplug_cb hotplug_cb = NULL;
+static void *hotplug_user_data = NULL;
+static struct hotplug_event *hotplug_pending = NULL;
+
+/* A single thread handles the libusb events for all the open devices
+   and for hotplug, so that the number of threads does not grow with the
+   number of devices. It is started by the first user (an open device or
+   the hotplug registration) and stopped by the last one. */
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t event_thread;
+static int event_thread_users = 0;
+static int event_thread_stop = 0;
+
+/* libusb devices seen by hid_enumerate_ids() or by hotplug, referenced
+   so that hid_open_path() finds them from the bus number and address
+   in the path, without walking the bus again. Hashed on bus/address. */
+struct known_device {
+	libusb_device *device;
+	struct known_device *next;
+};
+#define KNOWN_DEVICES_SIZE 64
+static pthread_mutex_t known_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct known_device *known_devices[KNOWN_DEVICES_SIZE];
+
 uint16_t get_usb_code_for_current_locale(void);
 static int return_data(hid_device *dev, unsigned char *data, size_t length);
 
@@ -124,7 +199,6 @@ static hid_device *new_hid_device(void)
 
 	pthread_mutex_init(&dev->mutex, NULL);
 	pthread_cond_init(&dev->condition, NULL);
-	pthread_barrier_init(&dev->barrier, NULL, 2);
 
 	return dev;
 }
@@ -132,10 +206,11 @@ static hid_device *new_hid_device(void)
 static void free_hid_device(hid_device *dev)
 {
 	/* Clean up the thread objects */
-	pthread_barrier_destroy(&dev->barrier);
 	pthread_cond_destroy(&dev->condition);
 	pthread_mutex_destroy(&dev->mutex);
 
+	free(dev->input_data);
+
 	/* Free the device itself */
 	free(dev);
 }
@@ -403,6 +478,92 @@ static char *make_path(libusb_device *dev, int interface_number)
 	return strdup(str);
 }
 
+static struct known_device **known_bucket(uint8_t bus, uint8_t address)
+{
+	return &known_devices[(bus * 131u + address) % KNOWN_DEVICES_SIZE];
+}
+
+/* Remember a device, replacing the one previously at its bus/address. */
+static void remember_device(libusb_device *device)
+{
+	uint8_t bus = libusb_get_bus_number(device);
+	uint8_t address = libusb_get_device_address(device);
+	struct known_device *k;
+
+	pthread_mutex_lock(&known_mutex);
+	for (k = *known_bucket(bus, address); k != NULL; k = k->next) {
+		if (libusb_get_bus_number(k->device) == bus &&
+		    libusb_get_device_address(k->device) == address)
+			break;
+	}
+	if (k == NULL) {
+		k = calloc(1, sizeof(struct known_device));
+		if (k) {
+			k->next = *known_bucket(bus, address);
+			*known_bucket(bus, address) = k;
+		}
+	}
+	if (k && k->device != device) {
+		if (k->device)
+			libusb_unref_device(k->device);
+		k->device = libusb_ref_device(device);
+	}
+	pthread_mutex_unlock(&known_mutex);
+}
+
+static void forget_device(libusb_device *device)
+{
+	struct known_device **cur, *k;
+
+	pthread_mutex_lock(&known_mutex);
+	cur = known_bucket(libusb_get_bus_number(device), libusb_get_device_address(device));
+	for (; *cur != NULL; cur = &(*cur)->next) {
+		if ((*cur)->device == device) {
+			k = *cur;
+			*cur = k->next;
+			libusb_unref_device(k->device);
+			free(k);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&known_mutex);
+}
+
+/* The device at bus/address, referenced, or NULL if not known. */
+static libusb_device *find_device(uint8_t bus, uint8_t address)
+{
+	libusb_device *device = NULL;
+	struct known_device *k;
+
+	pthread_mutex_lock(&known_mutex);
+	for (k = *known_bucket(bus, address); k != NULL; k = k->next) {
+		if (libusb_get_bus_number(k->device) == bus &&
+		    libusb_get_device_address(k->device) == address) {
+			device = libusb_ref_device(k->device);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&known_mutex);
+
+	return device;
+}
+
+static void forget_all_devices(void)
+{
+	struct known_device *k;
+	int i;
+
+	pthread_mutex_lock(&known_mutex);
+	for (i = 0; i < KNOWN_DEVICES_SIZE; i++) {
+		while ((k = known_devices[i]) != NULL) {
+			known_devices[i] = k->next;
+			libusb_unref_device(k->device);
+			free(k);
+		}
+	}
+	pthread_mutex_unlock(&known_mutex);
+}
+
 
 int HID_API_EXPORT hid_init(void)
 {
@@ -424,6 +585,15 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
+	hid_hotplug_deregister();
+	forget_all_devices();
+
+	if (async_pipe[0] >= 0) {
+		close(async_pipe[0]);
+		close(async_pipe[1]);
+		async_pipe[0] = async_pipe[1] = -1;
+	}
+
 	if (usb_context) {
 		libusb_exit(usb_context);
 		usb_context = NULL;
@@ -432,159 +602,211 @@ int HID_API_EXPORT hid_exit(void)
 	return 0;
 }
 
-struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+/* Whether a VID/PID matches one of the pairs of ids. */
+static int match_ids(const struct hid_device_id *ids, size_t num_ids, unsigned short vid, unsigned short pid)
+{
+	size_t i;
+	for (i = 0; i < num_ids; i++) {
+		if ((ids[i].vendor_id == 0x0 || ids[i].vendor_id == vid) &&
+		    (ids[i].product_id == 0x0 || ids[i].product_id == pid))
+			return 1;
+	}
+	return 0;
+}
+
+/* Create the records of the HID interfaces of a device. The strings are
+   only read when open_device is set: a device which has left can't be
+   opened any more, but its descriptors are still known to libusb. */
+static struct hid_device_info *create_device_info(libusb_device *dev, const struct libusb_device_descriptor *desc, int open_device)
 {
-	libusb_device **devs;
-	libusb_device *dev;
 	libusb_device_handle *handle;
-	ssize_t num_devs;
-	int i = 0;
+	struct libusb_config_descriptor *conf_desc = NULL;
+	int j, k;
+	int interface_num = 0;
+	int res;
 
 	struct hid_device_info *root = NULL; /* return object */
 	struct hid_device_info *cur_dev = NULL;
 
-	if(hid_init() < 0)
-		return NULL;
+	res = libusb_get_active_config_descriptor(dev, &conf_desc);
+	if (res < 0)
+		libusb_get_config_descriptor(dev, 0, &conf_desc);
+	if (conf_desc) {
+		for (j = 0; j < conf_desc->bNumInterfaces; j++) {
+			const struct libusb_interface *intf = &conf_desc->interface[j];
+			for (k = 0; k < intf->num_altsetting; k++) {
+				const struct libusb_interface_descriptor *intf_desc;
+				intf_desc = &intf->altsetting[k];
+				if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
+					interface_num = intf_desc->bInterfaceNumber;
 
-	num_devs = libusb_get_device_list(usb_context, &devs);
-	if (num_devs < 0)
-		return NULL;
-	while ((dev = devs[i++]) != NULL) {
-		struct libusb_device_descriptor desc;
-		struct libusb_config_descriptor *conf_desc = NULL;
-		int j, k;
-		int interface_num = 0;
+					/* VID/PID already checked against the arguments */
+					{
+						struct hid_device_info *tmp;
 
-		int res = libusb_get_device_descriptor(dev, &desc);
-		unsigned short dev_vid = desc.idVendor;
-		unsigned short dev_pid = desc.idProduct;
+						/* VID/PID match. Create the record. */
+						tmp = calloc(1, sizeof(struct hid_device_info));
+						if (cur_dev) {
+							cur_dev->next = tmp;
+						}
+						else {
+							root = tmp;
+						}
+						cur_dev = tmp;
 
-		res = libusb_get_active_config_descriptor(dev, &conf_desc);
-		if (res < 0)
-			libusb_get_config_descriptor(dev, 0, &conf_desc);
-		if (conf_desc) {
-			for (j = 0; j < conf_desc->bNumInterfaces; j++) {
-				const struct libusb_interface *intf = &conf_desc->interface[j];
-				for (k = 0; k < intf->num_altsetting; k++) {
-					const struct libusb_interface_descriptor *intf_desc;
-					intf_desc = &intf->altsetting[k];
-					if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-						interface_num = intf_desc->bInterfaceNumber;
-
-						/* Check the VID/PID against the arguments */
-						if ((vendor_id == 0x0 || vendor_id == dev_vid) &&
-						    (product_id == 0x0 || product_id == dev_pid)) {
-							struct hid_device_info *tmp;
-
-							/* VID/PID match. Create the record. */
-							tmp = calloc(1, sizeof(struct hid_device_info));
-							if (cur_dev) {
-								cur_dev->next = tmp;
-							}
-							else {
-								root = tmp;
-							}
-							cur_dev = tmp;
+						/* Fill out the record */
+						cur_dev->next = NULL;
+						cur_dev->path = make_path(dev, interface_num);
 
-							/* Fill out the record */
-							cur_dev->next = NULL;
-							cur_dev->path = make_path(dev, interface_num);
+						res = open_device ? libusb_open(dev, &handle) : -1;
 
-							res = libusb_open(dev, &handle);
+						if (res >= 0) {
+							/* Serial Number */
+							if (desc->iSerialNumber > 0)
+								cur_dev->serial_number =
+									get_usb_string(handle, desc->iSerialNumber);
 
-							if (res >= 0) {
-								/* Serial Number */
-								if (desc.iSerialNumber > 0)
-									cur_dev->serial_number =
-										get_usb_string(handle, desc.iSerialNumber);
-
-								/* Manufacturer and Product strings */
-								if (desc.iManufacturer > 0)
-									cur_dev->manufacturer_string =
-										get_usb_string(handle, desc.iManufacturer);
-								if (desc.iProduct > 0)
-									cur_dev->product_string =
-										get_usb_string(handle, desc.iProduct);
+							/* Manufacturer and Product strings */
+							if (desc->iManufacturer > 0)
+								cur_dev->manufacturer_string =
+									get_usb_string(handle, desc->iManufacturer);
+							if (desc->iProduct > 0)
+								cur_dev->product_string =
+									get_usb_string(handle, desc->iProduct);
 
 #ifdef INVASIVE_GET_USAGE
 {
-							/*
-							This section is removed because it is too
-							invasive on the system. Getting a Usage Page
-							and Usage requires parsing the HID Report
-							descriptor. Getting a HID Report descriptor
-							involves claiming the interface. Claiming the
-							interface involves detaching the kernel driver.
-							Detaching the kernel driver is hard on the system
-							because it will unclaim interfaces (if another
-							app has them claimed) and the re-attachment of
-							the driver will sometimes change /dev entry names.
-							It is for these reasons that this section is
-							#if 0. For composite devices, use the interface
-							field in the hid_device_info struct to distinguish
-							between interfaces. */
-								unsigned char data[256];
+						/*
+						This section is removed because it is too
+						invasive on the system. Getting a Usage Page
+						and Usage requires parsing the HID Report
+						descriptor. Getting a HID Report descriptor
+						involves claiming the interface. Claiming the
+						interface involves detaching the kernel driver.
+						Detaching the kernel driver is hard on the system
+						because it will unclaim interfaces (if another
+						app has them claimed) and the re-attachment of
+						the driver will sometimes change /dev entry names.
+						It is for these reasons that this section is
+						#if 0. For composite devices, use the interface
+						field in the hid_device_info struct to distinguish
+						between interfaces. */
+							unsigned char data[256];
 #ifdef DETACH_KERNEL_DRIVER
-								int detached = 0;
-								/* Usage Page and Usage */
-								res = libusb_kernel_driver_active(handle, interface_num);
-								if (res == 1) {
-									res = libusb_detach_kernel_driver(handle, interface_num);
-									if (res < 0)
-										LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
-									else
-										detached = 1;
-								}
+							int detached = 0;
+							/* Usage Page and Usage */
+							res = libusb_kernel_driver_active(handle, interface_num);
+							if (res == 1) {
+								res = libusb_detach_kernel_driver(handle, interface_num);
+								if (res < 0)
+									LOG("Couldn't detach kernel driver, even though a kernel driver was attached.");
+								else
+									detached = 1;
+							}
 #endif
-								res = libusb_claim_interface(handle, interface_num);
+							res = libusb_claim_interface(handle, interface_num);
+							if (res >= 0) {
+								/* Get the HID Report Descriptor. */
+								res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8)|interface_num, 0, data, sizeof(data), 5000);
 								if (res >= 0) {
-									/* Get the HID Report Descriptor. */
-									res = libusb_control_transfer(handle, LIBUSB_ENDPOINT_IN|LIBUSB_RECIPIENT_INTERFACE, LIBUSB_REQUEST_GET_DESCRIPTOR, (LIBUSB_DT_REPORT << 8)|interface_num, 0, data, sizeof(data), 5000);
-									if (res >= 0) {
-										unsigned short page=0, usage=0;
-										/* Parse the usage and usage page
-										   out of the report descriptor. */
-										get_usage(data, res,  &page, &usage);
-										cur_dev->usage_page = page;
-										cur_dev->usage = usage;
-									}
-									else
-										LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
-
-									/* Release the interface */
-									res = libusb_release_interface(handle, interface_num);
-									if (res < 0)
-										LOG("Can't release the interface.\n");
+									unsigned short page=0, usage=0;
+									/* Parse the usage and usage page
+									   out of the report descriptor. */
+									get_usage(data, res,  &page, &usage);
+									cur_dev->usage_page = page;
+									cur_dev->usage = usage;
 								}
 								else
-									LOG("Can't claim interface %d\n", res);
+									LOG("libusb_control_transfer() for getting the HID report failed with %d\n", res);
+
+								/* Release the interface */
+								res = libusb_release_interface(handle, interface_num);
+								if (res < 0)
+									LOG("Can't release the interface.\n");
+							}
+							else
+								LOG("Can't claim interface %d\n", res);
 #ifdef DETACH_KERNEL_DRIVER
-								/* Re-attach kernel driver if necessary. */
-								if (detached) {
-									res = libusb_attach_kernel_driver(handle, interface_num);
-									if (res < 0)
-										LOG("Couldn't re-attach kernel driver.\n");
-								}
+							/* Re-attach kernel driver if necessary. */
+							if (detached) {
+								res = libusb_attach_kernel_driver(handle, interface_num);
+								if (res < 0)
+									LOG("Couldn't re-attach kernel driver.\n");
+							}
 #endif
 }
 #endif /* INVASIVE_GET_USAGE */
 
-								libusb_close(handle);
-							}
-							/* VID/PID */
-							cur_dev->vendor_id = dev_vid;
-							cur_dev->product_id = dev_pid;
+							libusb_close(handle);
+						}
+						/* VID/PID */
+						cur_dev->vendor_id = desc->idVendor;
+						cur_dev->product_id = desc->idProduct;
 
-							/* Release Number */
-							cur_dev->release_number = desc.bcdDevice;
+						/* Release Number */
+						cur_dev->release_number = desc->bcdDevice;
 
-							/* Interface Number */
-							cur_dev->interface_number = interface_num;
-						}
+						/* Interface Number */
+						cur_dev->interface_number = interface_num;
 					}
-				} /* altsettings */
-			} /* interfaces */
-			libusb_free_config_descriptor(conf_desc);
+				}
+			} /* altsettings */
+		} /* interfaces */
+		libusb_free_config_descriptor(conf_desc);
+	}
+
+	return root;
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate(unsigned short vendor_id, unsigned short product_id)
+{
+	struct hid_device_id id;
+
+	id.vendor_id = vendor_id;
+	id.product_id = product_id;
+
+	return hid_enumerate_ids(&id, 1);
+}
+
+struct hid_device_info  HID_API_EXPORT *hid_enumerate_ids(const struct hid_device_id *ids, size_t num_ids)
+{
+	libusb_device **devs;
+	libusb_device *dev;
+	ssize_t num_devs;
+	int i = 0;
+
+	struct hid_device_info *root = NULL; /* return object */
+	struct hid_device_info *cur_dev = NULL;
+	struct hid_device_info *dev_info;
+
+	if(hid_init() < 0)
+		return NULL;
+
+	num_devs = libusb_get_device_list(usb_context, &devs);
+	if (num_devs < 0)
+		return NULL;
+	while ((dev = devs[i++]) != NULL) {
+		struct libusb_device_descriptor desc;
+
+		libusb_get_device_descriptor(dev, &desc);
+
+		/* Check the VID/PID against the arguments before reading
+		   the config descriptor of every device on the bus. */
+		if (!match_ids(ids, num_ids, desc.idVendor, desc.idProduct))
+			continue;
+
+		dev_info = create_device_info(dev, &desc, 1);
+		if (dev_info) {
+			remember_device(dev);
+			if (cur_dev) {
+				cur_dev->next = dev_info;
+			}
+			else {
+				root = dev_info;
+			}
+			cur_dev = dev_info;
+			while (cur_dev->next)
+				cur_dev = cur_dev->next;
 		}
 	}
 
@@ -642,55 +864,109 @@ hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const
 	return handle;
 }
 
-static void read_callback(struct libusb_transfer *transfer)
+static void *event_thread_fn(void *param)
 {
-	hid_device *dev = transfer->user_data;
+	struct timeval tv;
 	int res;
 
-	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+	while (!event_thread_stop) {
+		tv.tv_sec = 0;
+		tv.tv_usec = 100000;
+		res = libusb_handle_events_timeout_completed(usb_context, &tv, &event_thread_stop);
+		if (res < 0 &&
+		    res != LIBUSB_ERROR_BUSY &&
+		    res != LIBUSB_ERROR_TIMEOUT &&
+		    res != LIBUSB_ERROR_OVERFLOW &&
+		    res != LIBUSB_ERROR_INTERRUPTED) {
+			LOG("event_thread(): libusb reports error # %d\n", res);
+		}
+	}
 
-		struct input_report *rpt = malloc(sizeof(*rpt));
-		rpt->data = malloc(transfer->actual_length);
-		memcpy(rpt->data, transfer->buffer, transfer->actual_length);
-		rpt->len = transfer->actual_length;
-		rpt->next = NULL;
+	return NULL;
+}
 
-		pthread_mutex_lock(&dev->mutex);
+/* Start event_thread for its first user. */
+static int event_thread_acquire(void)
+{
+	int res = 0;
 
-		/* Attach the new report object to the end of the list. */
-		if (dev->input_reports == NULL) {
-			/* The list is empty. Put it at the root. */
-			dev->input_reports = rpt;
-			pthread_cond_signal(&dev->condition);
-		}
-		else {
-			/* Find the end of the list and attach. */
-			struct input_report *cur = dev->input_reports;
-			int num_queued = 0;
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
-			cur->next = rpt;
+	pthread_mutex_lock(&event_mutex);
+	if (event_thread_users == 0) {
+		event_thread_stop = 0;
+		if (pthread_create(&event_thread, NULL, event_thread_fn, NULL) != 0)
+			res = -1;
+	}
+	if (res == 0)
+		event_thread_users++;
+	pthread_mutex_unlock(&event_mutex);
 
-			/* Pop one off if we've reached 30 in the queue. This
-			   way we don't grow forever if the user never reads
-			   anything from the device. */
-			if (num_queued > 30) {
-				return_data(dev, NULL, 0);
-			}
-		}
-		pthread_mutex_unlock(&dev->mutex);
+	return res;
+}
+
+/* Stop event_thread after its last user. */
+static void event_thread_release(void)
+{
+	pthread_mutex_lock(&event_mutex);
+	if (--event_thread_users == 0) {
+		event_thread_stop = 1;
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000105)
+		/* Don't wait for the timeout of the event handling. */
+		libusb_interrupt_event_handler(usb_context);
+#endif
+		pthread_join(event_thread, NULL);
+	}
+	pthread_mutex_unlock(&event_mutex);
+}
+
+/* Queue an input report, called from read_callback() only. */
+static void push_input_report(hid_device *dev, const unsigned char *data, size_t len)
+{
+	unsigned int head = dev->input_head;
+	unsigned int tail = __atomic_load_n(&dev->input_tail, __ATOMIC_ACQUIRE);
+	unsigned int slot = head & (HID_INPUT_REPORTS - 1);
+
+	if (head - tail >= HID_INPUT_REPORTS) {
+		/* The reader is late. The slots being read can't be taken
+		   back, so this report is the one dropped. */
+		__atomic_add_fetch(&dev->input_overflows, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (len > (size_t)dev->input_ep_max_packet_size)
+		len = dev->input_ep_max_packet_size;
+	memcpy(dev->input_data + slot * dev->input_ep_max_packet_size, data, len);
+	dev->input_len[slot] = len;
+	__atomic_store_n(&dev->input_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Whether an input report is queued, called by the reader only. */
+static int input_report_available(hid_device *dev)
+{
+	return __atomic_load_n(&dev->input_head, __ATOMIC_ACQUIRE) != dev->input_tail;
+}
+
+/* Called by libusb from event_thread. */
+static void read_callback(struct libusb_transfer *transfer)
+{
+	hid_device *dev = transfer->user_data;
+	int res;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		push_input_report(dev, transfer->buffer, transfer->actual_length);
+
+	pthread_mutex_lock(&dev->mutex);
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		/* Wake a reader waiting in hid_read_timeout(). It checks the
+		   ring with the mutex locked before it waits, so the report
+		   pushed above can't be missed. */
+		pthread_cond_signal(&dev->condition);
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
 		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
-		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) {
 		dev->shutdown_thread = 1;
-		dev->cancelled = 1;
-		return;
 	}
 	else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
 		//LOG("Timeout (normal)\n");
@@ -699,25 +975,44 @@ static void read_callback(struct libusb_transfer *transfer)
 		LOG("Unknown transfer code: %d\n", transfer->status);
 	}
 
-	/* Re-submit the transfer object. */
-	res = libusb_submit_transfer(transfer);
-	if (res != 0) {
-		LOG("Unable to submit URB. libusb error code: %d\n", res);
-		dev->shutdown_thread = 1;
+	/* Re-submit the transfer object, unless hid_close() has been called.
+	   This is done under the mutex so that hid_close() cancels either
+	   this submission or none. */
+	if (!dev->shutdown_thread) {
+		res = libusb_submit_transfer(transfer);
+		if (res != 0) {
+			LOG("Unable to submit URB. libusb error code: %d\n", res);
+			dev->shutdown_thread = 1;
+		}
+	}
+
+	/* The transfer has ended, wake any threads which are waiting on
+	   data (in hid_read_timeout()) or on the end (in hid_close()). */
+	if (dev->shutdown_thread) {
 		dev->cancelled = 1;
+		pthread_cond_broadcast(&dev->condition);
 	}
-}
 
+	pthread_mutex_unlock(&dev->mutex);
+}
 
-static void *read_thread(void *param)
+/* Submit the transfer reading the INPUT endpoint, its completions are
+   handled by event_thread. */
+static int start_input_transfer(hid_device *dev)
 {
-	hid_device *dev = param;
 	unsigned char *buf;
 	const size_t length = dev->input_ep_max_packet_size;
 
-	/* Set up the transfer object. */
+	/* Set up the ring of input reports and the transfer object. */
+	dev->input_data = malloc(HID_INPUT_REPORTS * length);
 	buf = malloc(length);
 	dev->transfer = libusb_alloc_transfer(0);
+	if (!dev->input_data || !buf || !dev->transfer) {
+		free(buf);
+		libusb_free_transfer(dev->transfer);
+		dev->transfer = NULL;
+		return -1;
+	}
 	libusb_fill_interrupt_transfer(dev->transfer,
 		dev->device_handle,
 		dev->input_endpoint,
@@ -727,58 +1022,128 @@ static void *read_thread(void *param)
 		dev,
 		5000/*timeout*/);
 
+	if (event_thread_acquire() < 0)
+		goto fail;
+
 	/* Make the first submission. Further submissions are made
 	   from inside read_callback() */
-	libusb_submit_transfer(dev->transfer);
+	if (libusb_submit_transfer(dev->transfer) < 0) {
+		event_thread_release();
+		goto fail;
+	}
 
-	/* Notify the main thread that the read thread is up and running. */
-	pthread_barrier_wait(&dev->barrier);
+	return 0;
 
-	/* Handle all the events. */
-	while (!dev->shutdown_thread) {
-		int res;
-		res = libusb_handle_events(usb_context);
-		if (res < 0) {
-			/* There was an error. */
-			LOG("read_thread(): libusb reports error # %d\n", res);
-
-			/* Break out of this loop only on fatal error.*/
-			if (res != LIBUSB_ERROR_BUSY &&
-			    res != LIBUSB_ERROR_TIMEOUT &&
-			    res != LIBUSB_ERROR_OVERFLOW &&
-			    res != LIBUSB_ERROR_INTERRUPTED) {
-				break;
-			}
-		}
-	}
+fail:
+	free(buf);
+	libusb_free_transfer(dev->transfer);
+	dev->transfer = NULL;
+	return -1;
+}
 
-	/* Cancel any transfer that may be pending. This call will fail
-	   if no transfers are pending, but that's OK. */
-	libusb_cancel_transfer(dev->transfer);
 
-	while (!dev->cancelled)
-		libusb_handle_events_completed(usb_context, &dev->cancelled);
+/* Open the HID interface interface_number of usb_dev into dev. */
+static int open_device_interface(hid_device *dev, libusb_device *usb_dev, int interface_number)
+{
+	struct libusb_device_descriptor desc;
+	struct libusb_config_descriptor *conf_desc = NULL;
+	int i,j,k;
+	int res;
+	int good_open = 0;
 
-	/* Now that the read thread is stopping, Wake any threads which are
-	   waiting on data (in hid_read_timeout()). Do this under a mutex to
-	   make sure that a thread which is about to go to sleep waiting on
-	   the condition acutally will go to sleep before the condition is
-	   signaled. */
-	pthread_mutex_lock(&dev->mutex);
-	pthread_cond_broadcast(&dev->condition);
-	pthread_mutex_unlock(&dev->mutex);
+	libusb_get_device_descriptor(usb_dev, &desc);
+
+	if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0)
+		return 0;
+	for (j = 0; j < conf_desc->bNumInterfaces && !good_open; j++) {
+		const struct libusb_interface *intf = &conf_desc->interface[j];
+		for (k = 0; k < intf->num_altsetting && !good_open; k++) {
+			const struct libusb_interface_descriptor *intf_desc;
+			intf_desc = &intf->altsetting[k];
+			if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID &&
+			    intf_desc->bInterfaceNumber == interface_number) {
+				/* OPEN HERE */
+				res = libusb_open(usb_dev, &dev->device_handle);
+				if (res < 0) {
+					LOG("can't open device\n");
+					break;
+				}
+				good_open = 1;
+#ifdef DETACH_KERNEL_DRIVER
+				/* Detach the kernel driver, but only if the
+				   device is managed by the kernel */
+				if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
+					res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
+					if (res < 0) {
+						libusb_close(dev->device_handle);
+						LOG("Unable to detach Kernel Driver\n");
+						good_open = 0;
+						break;
+					}
+				}
+#endif
+				res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
+				if (res < 0) {
+					LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
+					libusb_close(dev->device_handle);
+					good_open = 0;
+					break;
+				}
 
-	/* The dev->transfer->buffer and dev->transfer objects are cleaned up
-	   in hid_close(). They are not cleaned up here because this thread
-	   could end either due to a disconnect or due to a user
-	   call to hid_close(). In both cases the objects can be safely
-	   cleaned up after the call to pthread_join() (in hid_close()), but
-	   since hid_close() calls libusb_cancel_transfer(), on these objects,
-	   they can not be cleaned up here. */
+				/* Store off the string descriptor indexes */
+				dev->manufacturer_index = desc.iManufacturer;
+				dev->product_index      = desc.iProduct;
+				dev->serial_index       = desc.iSerialNumber;
+
+				/* Store off the interface number */
+				dev->interface = intf_desc->bInterfaceNumber;
+
+				/* Find the INPUT and OUTPUT endpoints. An
+				   OUTPUT endpoint is not required. */
+				for (i = 0; i < intf_desc->bNumEndpoints; i++) {
+					const struct libusb_endpoint_descriptor *ep
+						= &intf_desc->endpoint[i];
+
+					/* Determine the type and direction of this
+					   endpoint. */
+					int is_interrupt =
+						(ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
+					      == LIBUSB_TRANSFER_TYPE_INTERRUPT;
+					int is_output =
+						(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+					      == LIBUSB_ENDPOINT_OUT;
+					int is_input =
+						(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
+					      == LIBUSB_ENDPOINT_IN;
+
+					/* Decide whether to use it for intput or output. */
+					if (dev->input_endpoint == 0 &&
+					    is_interrupt && is_input) {
+						/* Use this endpoint for INPUT */
+						dev->input_endpoint = ep->bEndpointAddress;
+						dev->input_ep_max_packet_size = ep->wMaxPacketSize;
+					}
+					if (dev->output_endpoint == 0 &&
+					    is_interrupt && is_output) {
+						/* Use this endpoint for OUTPUT */
+						dev->output_endpoint = ep->bEndpointAddress;
+					}
+				}
 
-	return NULL;
-}
+				if (start_input_transfer(dev) < 0) {
+					LOG("can't read from interface %d\n", intf_desc->bInterfaceNumber);
+					libusb_release_interface(dev->device_handle, intf_desc->bInterfaceNumber);
+					libusb_close(dev->device_handle);
+					good_open = 0;
+					break;
+				}
+			}
+		}
+	}
+	libusb_free_config_descriptor(conf_desc);
 
+	return good_open;
+}
 
 hid_device * HID_API_EXPORT hid_open_path(const char *path)
 {
@@ -786,121 +1151,43 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 
 	libusb_device **devs;
 	libusb_device *usb_dev;
-	int res;
+	unsigned int bus, address, interface_number;
 	int d = 0;
 	int good_open = 0;
 
 	if(hid_init() < 0)
 		return NULL;
 
-	dev = new_hid_device();
-
-	libusb_get_device_list(usb_context, &devs);
-	while ((usb_dev = devs[d++]) != NULL) {
-		struct libusb_device_descriptor desc;
-		struct libusb_config_descriptor *conf_desc = NULL;
-		int i,j,k;
-		libusb_get_device_descriptor(usb_dev, &desc);
-
-		if (libusb_get_active_config_descriptor(usb_dev, &conf_desc) < 0)
-			continue;
-		for (j = 0; j < conf_desc->bNumInterfaces; j++) {
-			const struct libusb_interface *intf = &conf_desc->interface[j];
-			for (k = 0; k < intf->num_altsetting; k++) {
-				const struct libusb_interface_descriptor *intf_desc;
-				intf_desc = &intf->altsetting[k];
-				if (intf_desc->bInterfaceClass == LIBUSB_CLASS_HID) {
-					char *dev_path = make_path(usb_dev, intf_desc->bInterfaceNumber);
-					if (!strcmp(dev_path, path)) {
-						/* Matched Paths. Open this device */
-
-						/* OPEN HERE */
-						res = libusb_open(usb_dev, &dev->device_handle);
-						if (res < 0) {
-							LOG("can't open device\n");
-							free(dev_path);
-							break;
-						}
-						good_open = 1;
-#ifdef DETACH_KERNEL_DRIVER
-						/* Detach the kernel driver, but only if the
-						   device is managed by the kernel */
-						if (libusb_kernel_driver_active(dev->device_handle, intf_desc->bInterfaceNumber) == 1) {
-							res = libusb_detach_kernel_driver(dev->device_handle, intf_desc->bInterfaceNumber);
-							if (res < 0) {
-								libusb_close(dev->device_handle);
-								LOG("Unable to detach Kernel Driver\n");
-								free(dev_path);
-								good_open = 0;
-								break;
-							}
-						}
-#endif
-						res = libusb_claim_interface(dev->device_handle, intf_desc->bInterfaceNumber);
-						if (res < 0) {
-							LOG("can't claim interface %d: %d\n", intf_desc->bInterfaceNumber, res);
-							free(dev_path);
-							libusb_close(dev->device_handle);
-							good_open = 0;
-							break;
-						}
-
-						/* Store off the string descriptor indexes */
-						dev->manufacturer_index = desc.iManufacturer;
-						dev->product_index      = desc.iProduct;
-						dev->serial_index       = desc.iSerialNumber;
-
-						/* Store off the interface number */
-						dev->interface = intf_desc->bInterfaceNumber;
-
-						/* Find the INPUT and OUTPUT endpoints. An
-						   OUTPUT endpoint is not required. */
-						for (i = 0; i < intf_desc->bNumEndpoints; i++) {
-							const struct libusb_endpoint_descriptor *ep
-								= &intf_desc->endpoint[i];
-
-							/* Determine the type and direction of this
-							   endpoint. */
-							int is_interrupt =
-								(ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK)
-							      == LIBUSB_TRANSFER_TYPE_INTERRUPT;
-							int is_output =
-								(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-							      == LIBUSB_ENDPOINT_OUT;
-							int is_input =
-								(ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK)
-							      == LIBUSB_ENDPOINT_IN;
-
-							/* Decide whether to use it for intput or output. */
-							if (dev->input_endpoint == 0 &&
-							    is_interrupt && is_input) {
-								/* Use this endpoint for INPUT */
-								dev->input_endpoint = ep->bEndpointAddress;
-								dev->input_ep_max_packet_size = ep->wMaxPacketSize;
-							}
-							if (dev->output_endpoint == 0 &&
-							    is_interrupt && is_output) {
-								/* Use this endpoint for OUTPUT */
-								dev->output_endpoint = ep->bEndpointAddress;
-							}
-						}
+	/* The path is made by make_path(), it holds all we need to find
+	   the device. */
+	if (sscanf(path, "%x:%x:%x", &bus, &address, &interface_number) != 3)
+		return NULL;
 
-						pthread_create(&dev->thread, NULL, read_thread, dev);
+	dev = new_hid_device();
 
-						/* Wait here for the read thread to be initialized. */
-						pthread_barrier_wait(&dev->barrier);
+	/* Most of the time the device has just been enumerated. */
+	usb_dev = find_device(bus, address);
+	if (usb_dev) {
+		good_open = open_device_interface(dev, usb_dev, interface_number);
+		if (!good_open)
+			forget_device(usb_dev);
+		libusb_unref_device(usb_dev);
+	}
 
-					}
-					free(dev_path);
-				}
+	if (!good_open) {
+		libusb_get_device_list(usb_context, &devs);
+		while ((usb_dev = devs[d++]) != NULL) {
+			if (libusb_get_bus_number(usb_dev) == bus &&
+			    libusb_get_device_address(usb_dev) == address) {
+				good_open = open_device_interface(dev, usb_dev, interface_number);
+				if (good_open)
+					remember_device(usb_dev);
+				break;
 			}
 		}
-		libusb_free_config_descriptor(conf_desc);
-
+		libusb_free_device_list(devs, 1);
 	}
 
-	libusb_free_device_list(devs, 1);
-
 	/* If we have a good handle, return it. */
 	if (good_open) {
 		return dev;
@@ -912,7 +1199,6 @@ hid_device * HID_API_EXPORT hid_open_path(const char *path)
 	}
 }
 
-
 int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t length)
 {
 	int res;
@@ -964,18 +1250,17 @@ int HID_API_EXPORT hid_write(hid_device *dev, const unsigned char *data, size_t
 }
 
 /* Helper function, to simplify hid_read().
-   This should be called with dev->mutex locked. */
+   This should be called by the reader, when a report is available. */
 static int return_data(hid_device *dev, unsigned char *data, size_t length)
 {
-	/* Copy the data out of the linked list item (rpt) into the
-	   return buffer (data), and delete the liked list item. */
-	struct input_report *rpt = dev->input_reports;
-	size_t len = (length < rpt->len)? length: rpt->len;
+	/* Copy the data out of the oldest slot into the return buffer
+	   (data), and give the slot back to read_callback(). */
+	unsigned int tail = dev->input_tail;
+	unsigned int slot = tail & (HID_INPUT_REPORTS - 1);
+	size_t len = (length < dev->input_len[slot])? length: dev->input_len[slot];
 	if (len > 0)
-		memcpy(data, rpt->data, len);
-	dev->input_reports = rpt->next;
-	free(rpt->data);
-	free(rpt);
+		memcpy(data, dev->input_data + slot * dev->input_ep_max_packet_size, len);
+	__atomic_store_n(&dev->input_tail, tail + 1, __ATOMIC_RELEASE);
 	return len;
 }
 
@@ -997,11 +1282,16 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 	return transferred;
 #endif
 
+	/* There's an input report queued up. Return it, without locking. */
+	if (input_report_available(dev))
+		return return_data(dev, data, length);
+
 	pthread_mutex_lock(&dev->mutex);
 	pthread_cleanup_push(&cleanup_mutex, dev);
 
-	/* There's an input report queued up. Return it. */
-	if (dev->input_reports) {
+	/* Check again with the mutex locked, read_callback() signals the
+	   condition with the mutex locked. */
+	if (input_report_available(dev)) {
 		/* Return the first one */
 		bytes_read = return_data(dev, data, length);
 		goto ret;
@@ -1016,10 +1306,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 
 	if (milliseconds == -1) {
 		/* Blocking */
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!input_report_available(dev) && !dev->shutdown_thread) {
 			pthread_cond_wait(&dev->condition, &dev->mutex);
 		}
-		if (dev->input_reports) {
+		if (input_report_available(dev)) {
 			bytes_read = return_data(dev, data, length);
 		}
 	}
@@ -1035,10 +1325,10 @@ int HID_API_EXPORT hid_read_timeout(hid_device *dev, unsigned char *data, size_t
 			ts.tv_nsec -= 1000000000L;
 		}
 
-		while (!dev->input_reports && !dev->shutdown_thread) {
+		while (!input_report_available(dev) && !dev->shutdown_thread) {
 			res = pthread_cond_timedwait(&dev->condition, &dev->mutex, &ts);
 			if (res == 0) {
-				if (dev->input_reports) {
+				if (input_report_available(dev)) {
 					bytes_read = return_data(dev, data, length);
 					break;
 				}
@@ -1076,6 +1366,29 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 	return hid_read_timeout(dev, data, length, dev->blocking ? -1 : 0);
 }
 
+int HID_API_EXPORT hid_read_many(hid_device *dev, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds)
+{
+	size_t n = 0;
+	int res;
+
+	if (count == 0)
+		return 0;
+
+	/* Wait for the first report only. */
+	res = hid_read_timeout(dev, data, length, milliseconds);
+	if (res <= 0)
+		return res;
+	lengths[n++] = res;
+
+	/* Then take the reports queued meanwhile, without locking. */
+	while (n < count && input_report_available(dev)) {
+		lengths[n] = return_data(dev, data + n * length, length);
+		n++;
+	}
+
+	return (int)n;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
@@ -1083,6 +1396,11 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0;
 }
 
+long HID_API_EXPORT hid_get_input_overflows(hid_device *dev)
+{
+	return (long)__atomic_load_n(&dev->input_overflows, __ATOMIC_RELAXED);
+}
+
 
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
@@ -1145,19 +1463,436 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 }
 
 
+/* Create the completion pipe. Must be called with async_mutex locked. */
+static int init_async_pipe(void)
+{
+	if (async_pipe[0] >= 0)
+		return 0;
+
+	if (pipe(async_pipe) < 0) {
+		async_pipe[0] = async_pipe[1] = -1;
+		return -1;
+	}
+	fcntl(async_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(async_pipe[1], F_SETFL, O_NONBLOCK);
+	fcntl(async_pipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(async_pipe[1], F_SETFD, FD_CLOEXEC);
+
+	return 0;
+}
+
+/* Remove a transfer from the pending ones of its device. Must be called
+   with async_mutex locked. */
+static void unlink_async_report(struct async_report *a)
+{
+	struct async_report **cur;
+
+	for (cur = &a->dev->async_pending; *cur != NULL; cur = &(*cur)->next) {
+		if (*cur == a) {
+			*cur = a->next;
+			break;
+		}
+	}
+}
+
+/* Called by libusb from event_thread, which runs while the device is
+   open. Queue the completion, it is reported
+   to the caller by hid_handle_events(). */
+static void async_callback(struct libusb_transfer *transfer)
+{
+	struct async_report *a = transfer->user_data;
+	struct async_report **cur;
+	const char wake = 0;
+
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+		a->res = transfer->actual_length;
+	else
+		a->res = -1;
+
+	pthread_mutex_lock(&async_mutex);
+	unlink_async_report(a);
+	for (cur = &async_completed; *cur != NULL; cur = &(*cur)->next)
+		;
+	*cur = a;
+	a->next = NULL;
+	if (write(async_pipe[1], &wake, 1) < 0)
+		LOG("async_callback(): can't wake the event handler\n");
+	pthread_cond_broadcast(&async_cond);
+	pthread_mutex_unlock(&async_mutex);
+}
+
+static int submit_feature_report(hid_device *dev, unsigned char *data, size_t length, int is_input, hid_feature_report_cb callback, void *user_data)
+{
+	struct async_report *a;
+	unsigned char *buf;
+	unsigned char *payload = data;
+	int report_number = data[0];
+	int res;
+
+	a = calloc(1, sizeof(struct async_report));
+	if (!a)
+		return -1;
+	a->dev = dev;
+	a->data = data;
+	a->length = length;
+	a->is_input = is_input;
+	a->callback = callback;
+	a->user_data = user_data;
+
+	if (report_number == 0x0) {
+		payload++;
+		length--;
+		a->skipped_report_id = 1;
+	}
+
+	pthread_mutex_lock(&async_mutex);
+	res = init_async_pipe();
+	pthread_mutex_unlock(&async_mutex);
+	if (res < 0) {
+		free(a);
+		return -1;
+	}
+
+	/* The setup packet and the data stage share one buffer, freed
+	   by libusb along with the transfer. */
+	buf = malloc(LIBUSB_CONTROL_SETUP_SIZE + length);
+	a->transfer = libusb_alloc_transfer(0);
+	if (!buf || !a->transfer) {
+		free(buf);
+		libusb_free_transfer(a->transfer);
+		free(a);
+		return -1;
+	}
+
+	if (is_input) {
+		libusb_fill_control_setup(buf,
+			LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_IN,
+			0x01/*HID get_report*/,
+			(3/*HID feature*/ << 8) | report_number,
+			dev->interface,
+			length);
+	}
+	else {
+		libusb_fill_control_setup(buf,
+			LIBUSB_REQUEST_TYPE_CLASS|LIBUSB_RECIPIENT_INTERFACE|LIBUSB_ENDPOINT_OUT,
+			0x09/*HID set_report*/,
+			(3/*HID feature*/ << 8) | report_number,
+			dev->interface,
+			length);
+		memcpy(buf + LIBUSB_CONTROL_SETUP_SIZE, payload, length);
+	}
+
+	libusb_fill_control_transfer(a->transfer, dev->device_handle, buf,
+		async_callback, a, 1000/*timeout millis*/);
+	a->transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
+
+	/* Track the transfer before it can complete, hid_close() waits
+	   for the ones still pending. */
+	pthread_mutex_lock(&async_mutex);
+	a->next = dev->async_pending;
+	dev->async_pending = a;
+	res = libusb_submit_transfer(a->transfer);
+	if (res < 0)
+		unlink_async_report(a);
+	pthread_mutex_unlock(&async_mutex);
+
+	if (res < 0) {
+		LOG("Unable to submit feature report. libusb error code: %d\n", res);
+		libusb_free_transfer(a->transfer);
+		free(a);
+		return -1;
+	}
+
+	return 0;
+}
+
+int HID_API_EXPORT hid_send_feature_report_async(hid_device *dev, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	return submit_feature_report(dev, (unsigned char *)data, length, 0, callback, user_data);
+}
+
+int HID_API_EXPORT hid_get_feature_report_async(hid_device *dev, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	return submit_feature_report(dev, data, length, 1, callback, user_data);
+}
+
+int HID_API_EXPORT hid_handle_events(int milliseconds)
+{
+	struct async_report *a;
+	struct hotplug_event *e;
+	hid_hotplug_cb callback;
+	void *user_data;
+	struct pollfd fds;
+	char drain[64];
+	int count = 0;
+	int pending = 0;
+
+	pthread_mutex_lock(&async_mutex);
+	if (init_async_pipe() < 0) {
+		pthread_mutex_unlock(&async_mutex);
+		return -1;
+	}
+	a = async_completed;
+	e = hotplug_pending;
+	pthread_mutex_unlock(&async_mutex);
+
+	if (a == NULL && e == NULL && milliseconds != 0) {
+		fds.fd = async_pipe[0];
+		fds.events = POLLIN;
+		fds.revents = 0;
+		if (poll(&fds, 1, milliseconds) < 0 && errno != EINTR)
+			return -1;
+	}
+
+	/* Report the completions queued so far, taken one at a time so
+	   that the ones waiting stay on async_completed, where hid_close()
+	   can still detach them from their device. The callbacks run
+	   without the lock so that they can submit new transfers, or
+	   close a device. */
+	pthread_mutex_lock(&async_mutex);
+	while (read(async_pipe[0], drain, sizeof(drain)) > 0)
+		;
+	for (a = async_completed; a != NULL; a = a->next)
+		pending++;
+	e = hotplug_pending;
+	hotplug_pending = NULL;
+	callback = hotplug_cb;
+	user_data = hotplug_user_data;
+	pthread_mutex_unlock(&async_mutex);
+
+	while (pending-- > 0) {
+		hid_device *dev;
+		int res;
+
+		pthread_mutex_lock(&async_mutex);
+		a = async_completed;
+		if (a != NULL) {
+			async_completed = a->next;
+			dev = a->dev;
+			res = a->res;
+		}
+		pthread_mutex_unlock(&async_mutex);
+		if (a == NULL)
+			break;
+
+		if (res >= 0) {
+			if (a->is_input) {
+				size_t len = a->length - a->skipped_report_id;
+				if ((size_t)res < len)
+					len = res;
+				memcpy(a->data + a->skipped_report_id,
+					libusb_control_transfer_get_data(a->transfer), len);
+			}
+			if (a->skipped_report_id)
+				res++;
+		}
+
+		libusb_free_transfer(a->transfer);
+		if (a->callback)
+			a->callback(dev, res, a->data, a->user_data);
+		free(a);
+		count++;
+	}
+
+	while (e) {
+		struct hotplug_event *next = e->next;
+		struct libusb_device_descriptor desc;
+		struct hid_device_info *devs;
+
+		/* The strings can only be read from a device still there. */
+		libusb_get_device_descriptor(e->device, &desc);
+		devs = create_device_info(e->device, &desc, e->event == HID_HOTPLUG_ARRIVED);
+		if (e->event == HID_HOTPLUG_ARRIVED)
+			remember_device(e->device);
+		else
+			forget_device(e->device);
+		if (devs && callback)
+			callback(e->event, devs, user_data);
+		hid_free_enumeration(devs);
+		libusb_unref_device(e->device);
+		free(e);
+		count++;
+
+		e = next;
+	}
+
+	return count;
+}
+
+int HID_API_EXPORT hid_get_event_fd(void)
+{
+	int res;
+
+	pthread_mutex_lock(&async_mutex);
+	res = init_async_pipe();
+	pthread_mutex_unlock(&async_mutex);
+
+	return (res < 0) ? -1 : async_pipe[0];
+}
+
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+	/* The transfers of all the devices are handled by event_thread. */
+	return -1;
+}
+
+/* Called by libusb while its events are handled. Devices can't be opened
+   from here, so the events are only queued for hid_handle_events(). */
+static int LIBUSB_CALL hotplug_callback(libusb_context *ctx, libusb_device *device, libusb_hotplug_event event, void *user_data)
+{
+	struct libusb_device_descriptor desc;
+	struct hotplug_event *e, **cur;
+	char wake = 0;
+
+	libusb_get_device_descriptor(device, &desc);
+
+	pthread_mutex_lock(&async_mutex);
+	if (hotplug_registered &&
+	    match_ids(hotplug_ids, hotplug_num_ids, desc.idVendor, desc.idProduct)) {
+		e = calloc(1, sizeof(struct hotplug_event));
+		if (e) {
+			e->device = libusb_ref_device(device);
+			e->event = (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) ?
+				HID_HOTPLUG_ARRIVED : HID_HOTPLUG_LEFT;
+			for (cur = &hotplug_pending; *cur != NULL; cur = &(*cur)->next)
+				;
+			*cur = e;
+			if (write(async_pipe[1], &wake, 1) < 0)
+				LOG("hotplug_callback(): can't wake the event handler\n");
+		}
+	}
+	pthread_mutex_unlock(&async_mutex);
+
+	return 0; /* stay registered */
+}
+
+int HID_API_EXPORT hid_hotplug_register(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data)
+{
+	struct hid_device_id *ids_copy;
+	libusb_hotplug_callback_handle handle;
+	int res;
+
+	if (hid_init() < 0)
+		return -1;
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return -1;
+
+	hid_hotplug_deregister();
+
+	ids_copy = calloc(num_ids ? num_ids : 1, sizeof(struct hid_device_id));
+	if (!ids_copy)
+		return -1;
+	memcpy(ids_copy, ids, num_ids * sizeof(struct hid_device_id));
+
+	pthread_mutex_lock(&async_mutex);
+	res = init_async_pipe();
+	pthread_mutex_unlock(&async_mutex);
+	if (res < 0) {
+		free(ids_copy);
+		return -1;
+	}
+
+	/* libusb takes a single VID/PID, match_ids() does the filtering. */
+	res = libusb_hotplug_register_callback(usb_context,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+		LIBUSB_HOTPLUG_NO_FLAGS,
+		LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+		hotplug_callback, NULL, &handle);
+	if (res != LIBUSB_SUCCESS) {
+		LOG("libusb_hotplug_register_callback() failed with %d\n", res);
+		free(ids_copy);
+		return -1;
+	}
+
+	if (event_thread_acquire() < 0) {
+		libusb_hotplug_deregister_callback(usb_context, handle);
+		free(ids_copy);
+		return -1;
+	}
+
+	pthread_mutex_lock(&async_mutex);
+	hotplug_handle = handle;
+	hotplug_ids = ids_copy;
+	hotplug_num_ids = num_ids;
+	hotplug_cb = callback;
+	hotplug_user_data = user_data;
+	hotplug_registered = 1;
+	pthread_mutex_unlock(&async_mutex);
+
+	return 0;
+}
+
+void HID_API_EXPORT hid_hotplug_deregister(void)
+{
+	struct hotplug_event *e;
+
+	pthread_mutex_lock(&async_mutex);
+	if (!hotplug_registered) {
+		pthread_mutex_unlock(&async_mutex);
+		return;
+	}
+	hotplug_registered = 0;
+	pthread_mutex_unlock(&async_mutex);
+
+	/* Not holding async_mutex, which hotplug_callback() takes. */
+	libusb_hotplug_deregister_callback(usb_context, hotplug_handle);
+	event_thread_release();
+
+	pthread_mutex_lock(&async_mutex);
+	free(hotplug_ids);
+	hotplug_ids = NULL;
+	hotplug_num_ids = 0;
+	hotplug_cb = NULL;
+	hotplug_user_data = NULL;
+	e = hotplug_pending;
+	hotplug_pending = NULL;
+	pthread_mutex_unlock(&async_mutex);
+
+	while (e) {
+		struct hotplug_event *next = e->next;
+		libusb_unref_device(e->device);
+		free(e);
+		e = next;
+	}
+}
+
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
+	struct async_report *a;
+
 	if (!dev)
 		return;
 
-	/* Cause read_thread() to stop. */
+	/* Cancel the feature reports still in flight and wait for
+	   event_thread to complete them. The completions queued for
+	   hid_handle_events() are reported with -1 and no device, so
+	   that their callbacks never see the freed handle. */
+	pthread_mutex_lock(&async_mutex);
+	for (a = dev->async_pending; a != NULL; a = a->next)
+		libusb_cancel_transfer(a->transfer);
+	while (dev->async_pending != NULL)
+		pthread_cond_wait(&async_cond, &async_mutex);
+	for (a = async_completed; a != NULL; a = a->next) {
+		if (a->dev == dev) {
+			a->dev = NULL;
+			a->res = -1;
+		}
+	}
+	pthread_mutex_unlock(&async_mutex);
+
+	/* Stop submitting the transfer. If it is still pending, cancel it
+	   and wait for event_thread to report the end. */
+	pthread_mutex_lock(&dev->mutex);
 	dev->shutdown_thread = 1;
-	libusb_cancel_transfer(dev->transfer);
+	if (!dev->cancelled)
+		libusb_cancel_transfer(dev->transfer);
+	while (!dev->cancelled)
+		pthread_cond_wait(&dev->condition, &dev->mutex);
+	pthread_mutex_unlock(&dev->mutex);
 
-	/* Wait for read_thread() to end. */
-	pthread_join(dev->thread, NULL);
+	event_thread_release();
 
-	/* Clean up the Transfer objects allocated in read_thread(). */
+	/* Clean up the Transfer objects allocated in start_input_transfer(). */
 	free(dev->transfer->buffer);
 	libusb_free_transfer(dev->transfer);
 
@@ -1167,13 +1902,6 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	/* Close the handle */
 	libusb_close(dev->device_handle);
 
-	/* Clear out the queue of received reports. */
-	pthread_mutex_lock(&dev->mutex);
-	while (dev->input_reports) {
-		return_data(dev, NULL, 0);
-	}
-	pthread_mutex_unlock(&dev->mutex);
-
 	free_hid_device(dev);
 }
 
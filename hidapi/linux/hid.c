@@ -80,6 +80,14 @@ struct hid_device_ {
 
 static __u32 kernel_version = 0;
 
+/* Hotplug registration: a udev monitor on the hidraw subsystem. */
+static struct udev *hotplug_udev = NULL;
+static struct udev_monitor *hotplug_monitor = NULL;
+static struct hid_device_id *hotplug_ids = NULL;
+static size_t hotplug_num_ids = 0;
+static hid_hotplug_cb hotplug_cb = NULL;
+static void *hotplug_user_data = NULL;
+
 static __u32 detect_kernel_version(void)
 {
 	struct utsname name;
@@ -373,7 +381,7 @@ int HID_API_EXPORT hid_init(void)
 
 int HID_API_EXPORT hid_exit(void)
 {
-	/* Nothing to do for this in the Linux/hidraw implementation. */
+	hid_hotplug_deregister();
 	return 0;
 }
 
@@ -580,6 +588,42 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
+/* Whether a VID/PID matches one of the pairs of ids. */
+static int match_ids(const struct hid_device_id *ids, size_t num_ids, unsigned short vid, unsigned short pid)
+{
+	size_t i;
+	for (i = 0; i < num_ids; i++) {
+		if ((ids[i].vendor_id == 0x0 || ids[i].vendor_id == vid) &&
+		    (ids[i].product_id == 0x0 || ids[i].product_id == pid))
+			return 1;
+	}
+	return 0;
+}
+
+struct hid_device_info HID_API_EXPORT *hid_enumerate_ids(const struct hid_device_id *ids, size_t num_ids)
+{
+	/* Walk the devices once, and keep the ones matching one of the ids. */
+	struct hid_device_info *root = NULL;
+	struct hid_device_info **tail = &root;
+	struct hid_device_info *cur_dev = hid_enumerate(0x0, 0x0);
+
+	while (cur_dev) {
+		struct hid_device_info *next = cur_dev->next;
+
+		cur_dev->next = NULL;
+		if (match_ids(ids, num_ids, cur_dev->vendor_id, cur_dev->product_id)) {
+			*tail = cur_dev;
+			tail = &cur_dev->next;
+		}
+		else {
+			hid_free_enumeration(cur_dev);
+		}
+		cur_dev = next;
+	}
+
+	return root;
+}
+
 hid_device * hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	struct hid_device_info *devs, *cur_dev;
@@ -724,6 +768,38 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_many(hid_device *dev, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds)
+{
+	size_t n = 0;
+	int res;
+
+	if (count == 0)
+		return 0;
+
+	/* Wait for the first report only. */
+	res = hid_read_timeout(dev, data, length, milliseconds);
+	if (res <= 0)
+		return res;
+	lengths[n++] = res;
+
+	if (n == count)
+		return (int)n;
+
+	/* hidraw returns one report per read(). Take the reports already
+	   queued, each behind a poll() that does not wait: the flags of the
+	   descriptor are left alone, another thread may be reading it. An
+	   error after the first report ends the batch, the next call
+	   reports it. */
+	while (n < count) {
+		res = hid_read_timeout(dev, data + n * length, length, 0);
+		if (res <= 0)
+			break;
+		lengths[n++] = res;
+	}
+
+	return (int)n;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* Do all non-blocking in userspace using poll(), since it looks
@@ -734,6 +810,12 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0; /* Success */
 }
 
+long HID_API_EXPORT hid_get_input_overflows(hid_device *dev)
+{
+	/* hidraw queues the reports, and drops them silently. */
+	return -1;
+}
+
 
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
@@ -767,6 +849,192 @@ void HID_API_EXPORT hid_close(hid_device *dev)
 	free(dev);
 }
 
+int HID_API_EXPORT hid_send_feature_report_async(hid_device *dev, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+int HID_API_EXPORT hid_get_feature_report_async(hid_device *dev, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+/* Record of a hidraw node which has just been added, NULL if it is not
+   one of the devices hid_hotplug_register() was asked for. */
+static struct hid_device_info *hotplug_device_info(struct udev_device *raw_dev)
+{
+	struct udev_device *hid_dev; /* The device's HID udev node. */
+	struct udev_device *usb_dev; /* The device's USB udev node. */
+	struct udev_device *intf_dev; /* The device's interface (in the USB sense). */
+	struct hid_device_info *cur_dev = NULL;
+	const char *dev_path = udev_device_get_devnode(raw_dev);
+	const char *uevent = NULL;
+	const char *str;
+	unsigned short dev_vid;
+	unsigned short dev_pid;
+	char *serial_number_utf8 = NULL;
+	char *product_name_utf8 = NULL;
+	int bus_type;
+
+	hid_dev = udev_device_get_parent_with_subsystem_devtype(raw_dev, "hid", NULL);
+	if (hid_dev)
+		uevent = udev_device_get_sysattr_value(hid_dev, "uevent");
+	if (!dev_path || !uevent)
+		return NULL;
+
+	if (!parse_uevent_info(uevent, &bus_type, &dev_vid, &dev_pid,
+			&serial_number_utf8, &product_name_utf8))
+		goto end;
+	if (bus_type != BUS_USB && bus_type != BUS_BLUETOOTH)
+		goto end;
+	if (!match_ids(hotplug_ids, hotplug_num_ids, dev_vid, dev_pid))
+		goto end;
+
+	cur_dev = calloc(1, sizeof(struct hid_device_info));
+	if (!cur_dev)
+		goto end;
+	cur_dev->path = strdup(dev_path);
+	cur_dev->vendor_id = dev_vid;
+	cur_dev->product_id = dev_pid;
+	cur_dev->serial_number = utf8_to_wchar_t(serial_number_utf8);
+	cur_dev->interface_number = -1;
+
+	if (bus_type == BUS_USB) {
+		usb_dev = udev_device_get_parent_with_subsystem_devtype(raw_dev, "usb", "usb_device");
+		if (usb_dev) {
+			cur_dev->manufacturer_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_MANUFACTURER]);
+			cur_dev->product_string = copy_udev_string(usb_dev, device_string_names[DEVICE_STRING_PRODUCT]);
+			str = udev_device_get_sysattr_value(usb_dev, "bcdDevice");
+			cur_dev->release_number = (str)? strtol(str, NULL, 16): 0x0;
+		}
+		intf_dev = udev_device_get_parent_with_subsystem_devtype(raw_dev, "usb", "usb_interface");
+		if (intf_dev) {
+			str = udev_device_get_sysattr_value(intf_dev, "bInterfaceNumber");
+			cur_dev->interface_number = (str)? strtol(str, NULL, 16): -1;
+		}
+	}
+	else {
+		cur_dev->manufacturer_string = wcsdup(L"");
+		cur_dev->product_string = utf8_to_wchar_t(product_name_utf8);
+	}
+
+end:
+	free(serial_number_utf8);
+	free(product_name_utf8);
+	return cur_dev;
+}
+
+int HID_API_EXPORT hid_handle_events(int milliseconds)
+{
+	struct udev_device *raw_dev;
+	struct pollfd fds;
+	int count = 0;
+
+	/* Asynchronous transfers are not supported by this implementation,
+	   only hotplug events are reported. */
+	if (!hotplug_monitor)
+		return -1;
+
+	fds.fd = udev_monitor_get_fd(hotplug_monitor);
+	fds.events = POLLIN;
+	fds.revents = 0;
+	if (poll(&fds, 1, milliseconds) < 0 && errno != EINTR)
+		return -1;
+	if (!(fds.revents & POLLIN))
+		return 0;
+
+	/* The monitor socket is non-blocking, receive everything queued. */
+	while ((raw_dev = udev_monitor_receive_device(hotplug_monitor)) != NULL) {
+		const char *action = udev_device_get_action(raw_dev);
+		const char *dev_path = udev_device_get_devnode(raw_dev);
+		struct hid_device_info *info = NULL;
+		int event = 0;
+
+		if (action && strcmp(action, "add") == 0) {
+			event = HID_HOTPLUG_ARRIVED;
+			info = hotplug_device_info(raw_dev);
+		}
+		else if (action && strcmp(action, "remove") == 0 && dev_path) {
+			/* The parent nodes are gone, only the path is known. */
+			event = HID_HOTPLUG_LEFT;
+			info = calloc(1, sizeof(struct hid_device_info));
+			if (info) {
+				info->path = strdup(dev_path);
+				info->interface_number = -1;
+			}
+		}
+
+		if (info) {
+			if (hotplug_cb)
+				hotplug_cb(event, info, hotplug_user_data);
+			hid_free_enumeration(info);
+			count++;
+		}
+		udev_device_unref(raw_dev);
+	}
+
+	return count;
+}
+
+int HID_API_EXPORT hid_get_event_fd(void)
+{
+	if (!hotplug_monitor)
+		return -1;
+	return udev_monitor_get_fd(hotplug_monitor);
+}
+
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+	return dev->device_handle;
+}
+
+int HID_API_EXPORT hid_hotplug_register(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data)
+{
+	hid_hotplug_deregister();
+
+	hotplug_ids = calloc(num_ids ? num_ids : 1, sizeof(struct hid_device_id));
+	if (!hotplug_ids)
+		return -1;
+	memcpy(hotplug_ids, ids, num_ids * sizeof(struct hid_device_id));
+	hotplug_num_ids = num_ids;
+
+	hotplug_udev = udev_new();
+	if (!hotplug_udev)
+		goto err;
+	hotplug_monitor = udev_monitor_new_from_netlink(hotplug_udev, "udev");
+	if (!hotplug_monitor)
+		goto err;
+	if (udev_monitor_filter_add_match_subsystem_devtype(hotplug_monitor, "hidraw", NULL) < 0 ||
+	    udev_monitor_enable_receiving(hotplug_monitor) < 0)
+		goto err;
+
+	hotplug_cb = callback;
+	hotplug_user_data = user_data;
+	return 0;
+
+err:
+	hid_hotplug_deregister();
+	return -1;
+}
+
+void HID_API_EXPORT hid_hotplug_deregister(void)
+{
+	if (hotplug_monitor)
+		udev_monitor_unref(hotplug_monitor);
+	if (hotplug_udev)
+		udev_unref(hotplug_udev);
+	free(hotplug_ids);
+
+	hotplug_monitor = NULL;
+	hotplug_udev = NULL;
+	hotplug_ids = NULL;
+	hotplug_num_ids = 0;
+	hotplug_cb = NULL;
+	hotplug_user_data = NULL;
+}
+
 
 int HID_API_EXPORT_CALL hid_get_manufacturer_string(hid_device *dev, wchar_t *string, size_t maxlen)
 {
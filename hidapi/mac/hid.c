@@ -512,6 +512,36 @@ void  HID_API_EXPORT hid_free_enumeration(struct hid_device_info *devs)
 	}
 }
 
+struct hid_device_info HID_API_EXPORT *hid_enumerate_ids(const struct hid_device_id *ids, size_t num_ids)
+{
+	/* Walk the devices once, and keep the ones matching one of the ids. */
+	struct hid_device_info *root = NULL;
+	struct hid_device_info **tail = &root;
+	struct hid_device_info *cur_dev = hid_enumerate(0x0, 0x0);
+
+	while (cur_dev) {
+		struct hid_device_info *next = cur_dev->next;
+		size_t i;
+
+		cur_dev->next = NULL;
+		for (i = 0; i < num_ids; i++) {
+			if ((ids[i].vendor_id == 0x0 || ids[i].vendor_id == cur_dev->vendor_id) &&
+			    (ids[i].product_id == 0x0 || ids[i].product_id == cur_dev->product_id))
+				break;
+		}
+		if (i < num_ids) {
+			*tail = cur_dev;
+			tail = &cur_dev->next;
+		}
+		else {
+			hid_free_enumeration(cur_dev);
+		}
+		cur_dev = next;
+	}
+
+	return root;
+}
+
 hid_device * HID_API_EXPORT hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	/* This function is identical to the Linux version. Platform independent. */
@@ -933,6 +963,31 @@ int HID_API_EXPORT hid_read(hid_device *dev, unsigned char *data, size_t length)
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT hid_read_many(hid_device *dev, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds)
+{
+	size_t n = 0;
+	int res;
+
+	if (count == 0)
+		return 0;
+
+	/* Wait for the first report only. */
+	res = hid_read_timeout(dev, data, length, milliseconds);
+	if (res <= 0)
+		return res;
+	lengths[n++] = res;
+
+	/* Then take the reports already queued. */
+	while (n < count) {
+		res = hid_read_timeout(dev, data + n * length, length, 0);
+		if (res <= 0)
+			break;
+		lengths[n++] = res;
+	}
+
+	return (int)n;
+}
+
 int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	/* All Nonblocking operation is handled by the library. */
@@ -941,6 +996,12 @@ int HID_API_EXPORT hid_set_nonblocking(hid_device *dev, int nonblock)
 	return 0;
 }
 
+long HID_API_EXPORT hid_get_input_overflows(hid_device *dev)
+{
+	/* Not counted by this backend. */
+	return -1;
+}
+
 int HID_API_EXPORT hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	return set_report(dev, kIOHIDReportTypeFeature, data, length);
@@ -965,6 +1026,44 @@ int HID_API_EXPORT hid_get_feature_report(hid_device *dev, unsigned char *data,
 		return -1;
 }
 
+int HID_API_EXPORT hid_send_feature_report_async(hid_device *dev, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+int HID_API_EXPORT hid_get_feature_report_async(hid_device *dev, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+int HID_API_EXPORT hid_handle_events(int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT hid_get_event_fd(void)
+{
+	return -1;
+}
+
+int HID_API_EXPORT hid_get_fd(hid_device *dev)
+{
+	/* The reports are received by the run loop of read_thread. */
+	return -1;
+}
+
+int HID_API_EXPORT hid_hotplug_register(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+void HID_API_EXPORT hid_hotplug_deregister(void)
+{
+}
+
 
 void HID_API_EXPORT hid_close(hid_device *dev)
 {
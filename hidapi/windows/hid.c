@@ -504,6 +504,36 @@ void  HID_API_EXPORT HID_API_CALL hid_free_enumeration(struct hid_device_info *d
 }
 
 
+struct hid_device_info HID_API_EXPORT HID_API_CALL *hid_enumerate_ids(const struct hid_device_id *ids, size_t num_ids)
+{
+	/* Walk the devices once, and keep the ones matching one of the ids. */
+	struct hid_device_info *root = NULL;
+	struct hid_device_info **tail = &root;
+	struct hid_device_info *cur_dev = hid_enumerate(0x0, 0x0);
+
+	while (cur_dev) {
+		struct hid_device_info *next = cur_dev->next;
+		size_t i;
+
+		cur_dev->next = NULL;
+		for (i = 0; i < num_ids; i++) {
+			if ((ids[i].vendor_id == 0x0 || ids[i].vendor_id == cur_dev->vendor_id) &&
+			    (ids[i].product_id == 0x0 || ids[i].product_id == cur_dev->product_id))
+				break;
+		}
+		if (i < num_ids) {
+			*tail = cur_dev;
+			tail = &cur_dev->next;
+		}
+		else {
+			hid_free_enumeration(cur_dev);
+		}
+		cur_dev = next;
+	}
+
+	return root;
+}
+
 HID_API_EXPORT hid_device * HID_API_CALL hid_open(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number)
 {
 	/* TODO: Merge this functions with the Linux version. This function should be platform independent. */
@@ -722,12 +752,43 @@ int HID_API_EXPORT HID_API_CALL hid_read(hid_device *dev, unsigned char *data, s
 	return hid_read_timeout(dev, data, length, (dev->blocking)? -1: 0);
 }
 
+int HID_API_EXPORT HID_API_CALL hid_read_many(hid_device *dev, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds)
+{
+	size_t n = 0;
+	int res;
+
+	if (count == 0)
+		return 0;
+
+	/* Wait for the first report only. */
+	res = hid_read_timeout(dev, data, length, milliseconds);
+	if (res <= 0)
+		return res;
+	lengths[n++] = res;
+
+	/* Then take the reports already queued. */
+	while (n < count) {
+		res = hid_read_timeout(dev, data + n * length, length, 0);
+		if (res <= 0)
+			break;
+		lengths[n++] = res;
+	}
+
+	return (int)n;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_set_nonblocking(hid_device *dev, int nonblock)
 {
 	dev->blocking = !nonblock;
 	return 0; /* Success */
 }
 
+long HID_API_EXPORT HID_API_CALL hid_get_input_overflows(hid_device *dev)
+{
+	/* The HID class driver queues the reports. */
+	return -1;
+}
+
 int HID_API_EXPORT HID_API_CALL hid_send_feature_report(hid_device *dev, const unsigned char *data, size_t length)
 {
 	BOOL res = HidD_SetFeature(dev->device_handle, (PVOID)data, length);
@@ -782,6 +843,44 @@ int HID_API_EXPORT HID_API_CALL hid_get_feature_report(hid_device *dev, unsigned
 #endif
 }
 
+int HID_API_EXPORT HID_API_CALL hid_send_feature_report_async(hid_device *dev, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_feature_report_async(hid_device *dev, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_handle_events(int milliseconds)
+{
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_event_fd(void)
+{
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_get_fd(hid_device *dev)
+{
+	/* Reads are overlapped operations on a HANDLE, not descriptors. */
+	return -1;
+}
+
+int HID_API_EXPORT HID_API_CALL hid_hotplug_register(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data)
+{
+	/* Not supported by this implementation. */
+	return -1;
+}
+
+void HID_API_EXPORT HID_API_CALL hid_hotplug_deregister(void)
+{
+}
+
 void HID_API_EXPORT HID_API_CALL hid_close(hid_device *dev)
 {
 	if (!dev)
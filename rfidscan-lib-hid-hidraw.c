@@ -0,0 +1,9 @@
+// hidapi hidraw backend, linked along with the libusb one
+// see rfidscan-lib-hidbackend.h
+
+#define RFIDSCAN_HID_PREFIX hidraw_
+#include "rfidscan-lib-hidrename.h"
+#include "hidapi/linux/hid.c"
+#include "rfidscan-lib-hidbackend.h"
+
+RFIDSCAN_HID_BACKEND( rfidscan_hid_hidraw, "hidraw" );
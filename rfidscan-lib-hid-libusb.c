@@ -0,0 +1,9 @@
+// hidapi libusb backend, linked along with the hidraw one
+// see rfidscan-lib-hidbackend.h
+
+#define RFIDSCAN_HID_PREFIX libusb_
+#include "rfidscan-lib-hidrename.h"
+#include "hidapi/libusb/hid.c"
+#include "rfidscan-lib-hidbackend.h"
+
+RFIDSCAN_HID_BACKEND( rfidscan_hid_libusb, "libusb" );
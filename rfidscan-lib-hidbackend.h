@@ -0,0 +1,57 @@
+// Table of the hidapi functions used by rfidscan-lib, one per backend
+// linked in. Built when RFIDSCAN_HID_BACKENDS is defined, see the Makefile:
+// rfidscan_setBackend() then picks the backend at runtime.
+
+#ifndef __RFIDSCAN_LIB_HIDBACKEND_H__
+#define __RFIDSCAN_LIB_HIDBACKEND_H__
+
+#include "hidapi/hidapi/hidapi.h"
+
+typedef struct rfidscan_hid_backend_ {
+    const char* name;
+    int (*exit)(void);
+    struct hid_device_info* (*enumerate_ids)(const struct hid_device_id *ids, size_t num_ids);
+    void (*free_enumeration)(struct hid_device_info *devs);
+    hid_device* (*open)(unsigned short vendor_id, unsigned short product_id, const wchar_t *serial_number);
+    hid_device* (*open_path)(const char *path);
+    void (*close)(hid_device *dev);
+    int (*read_many)(hid_device *dev, unsigned char *data, size_t length, size_t *lengths, size_t count, int milliseconds);
+    int (*send_feature_report)(hid_device *dev, const unsigned char *data, size_t length);
+    int (*get_feature_report)(hid_device *dev, unsigned char *data, size_t length);
+    int (*send_feature_report_async)(hid_device *dev, const unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data);
+    int (*get_feature_report_async)(hid_device *dev, unsigned char *data, size_t length, hid_feature_report_cb callback, void *user_data);
+    int (*handle_events)(int milliseconds);
+    int (*get_event_fd)(void);
+    int (*get_fd)(hid_device *dev);
+    int (*hotplug_register)(const struct hid_device_id *ids, size_t num_ids, hid_hotplug_cb callback, void *user_data);
+    void (*hotplug_deregister)(void);
+    const wchar_t* (*error)(hid_device *dev);
+} rfidscan_hid_backend;
+
+// define the table of a backend, after its hid.c and rfidscan-lib-hidrename.h
+#define RFIDSCAN_HID_BACKEND(var, label)    \
+    const rfidscan_hid_backend var = {      \
+        label,                              \
+        hid_exit,                           \
+        hid_enumerate_ids,                  \
+        hid_free_enumeration,               \
+        hid_open,                           \
+        hid_open_path,                      \
+        hid_close,                          \
+        hid_read_many,                      \
+        hid_send_feature_report,            \
+        hid_get_feature_report,             \
+        hid_send_feature_report_async,      \
+        hid_get_feature_report_async,       \
+        hid_handle_events,                  \
+        hid_get_event_fd,                   \
+        hid_get_fd,                         \
+        hid_hotplug_register,               \
+        hid_hotplug_deregister,             \
+        hid_error,                          \
+    }
+
+extern const rfidscan_hid_backend rfidscan_hid_libusb;  // claims the USB interface
+extern const rfidscan_hid_backend rfidscan_hid_hidraw;  // /dev/hidraw*, usbhid stays bound
+
+#endif
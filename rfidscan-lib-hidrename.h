@@ -0,0 +1,45 @@
+// Rename the public functions of an hidapi backend, so that several
+// backends can be linked in the same library. Define RFIDSCAN_HID_PREFIX
+// then include this file before the hid.c of the backend, as done by
+// rfidscan-lib-hid-libusb.c and rfidscan-lib-hid-hidraw.c
+
+#ifndef RFIDSCAN_HID_PREFIX
+#error RFIDSCAN_HID_PREFIX must be defined
+#endif
+
+#define RFIDSCAN_HID_CAT_(a,b) a##b
+#define RFIDSCAN_HID_CAT(a,b)  RFIDSCAN_HID_CAT_(a,b)
+#define RFIDSCAN_HID_NAME(name) RFIDSCAN_HID_CAT(RFIDSCAN_HID_PREFIX, name)
+
+#define hid_init                      RFIDSCAN_HID_NAME(hid_init)
+#define hid_exit                      RFIDSCAN_HID_NAME(hid_exit)
+#define hid_enumerate                 RFIDSCAN_HID_NAME(hid_enumerate)
+#define hid_enumerate_ids             RFIDSCAN_HID_NAME(hid_enumerate_ids)
+#define hid_free_enumeration          RFIDSCAN_HID_NAME(hid_free_enumeration)
+#define hid_open                      RFIDSCAN_HID_NAME(hid_open)
+#define hid_open_path                 RFIDSCAN_HID_NAME(hid_open_path)
+#define hid_write                     RFIDSCAN_HID_NAME(hid_write)
+#define hid_read_timeout              RFIDSCAN_HID_NAME(hid_read_timeout)
+#define hid_read                      RFIDSCAN_HID_NAME(hid_read)
+#define hid_read_many                 RFIDSCAN_HID_NAME(hid_read_many)
+#define hid_set_nonblocking           RFIDSCAN_HID_NAME(hid_set_nonblocking)
+#define hid_get_input_overflows       RFIDSCAN_HID_NAME(hid_get_input_overflows)
+#define hid_send_feature_report       RFIDSCAN_HID_NAME(hid_send_feature_report)
+#define hid_get_feature_report        RFIDSCAN_HID_NAME(hid_get_feature_report)
+#define hid_send_feature_report_async RFIDSCAN_HID_NAME(hid_send_feature_report_async)
+#define hid_get_feature_report_async  RFIDSCAN_HID_NAME(hid_get_feature_report_async)
+#define hid_handle_events             RFIDSCAN_HID_NAME(hid_handle_events)
+#define hid_get_event_fd              RFIDSCAN_HID_NAME(hid_get_event_fd)
+#define hid_get_fd                    RFIDSCAN_HID_NAME(hid_get_fd)
+#define hid_hotplug_register          RFIDSCAN_HID_NAME(hid_hotplug_register)
+#define hid_hotplug_deregister        RFIDSCAN_HID_NAME(hid_hotplug_deregister)
+#define hid_close                     RFIDSCAN_HID_NAME(hid_close)
+#define hid_get_manufacturer_string   RFIDSCAN_HID_NAME(hid_get_manufacturer_string)
+#define hid_get_product_string        RFIDSCAN_HID_NAME(hid_get_product_string)
+#define hid_get_serial_number_string  RFIDSCAN_HID_NAME(hid_get_serial_number_string)
+#define hid_get_indexed_string        RFIDSCAN_HID_NAME(hid_get_indexed_string)
+#define hid_error                     RFIDSCAN_HID_NAME(hid_error)
+
+// not static in the backends either
+#define get_usb_code_for_current_locale RFIDSCAN_HID_NAME(get_usb_code_for_current_locale)
+#define device_string_names           RFIDSCAN_HID_NAME(device_string_names)
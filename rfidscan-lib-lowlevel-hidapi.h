@@ -1,70 +1,321 @@
 #include "hidapi/hidapi/hidapi.h"
 
+#ifdef __linux__
+#include <errno.h>
+#include <sys/epoll.h>  // for rfidscan_handleEvents()
+#endif
+
+#ifdef RFIDSCAN_HID_BACKENDS
+#include "rfidscan-lib-hidbackend.h"
+
+static const rfidscan_hid_backend* rfidscan_hid_backends[] = {
+    &rfidscan_hid_libusb,
+    &rfidscan_hid_hidraw,
+};
+static const rfidscan_hid_backend* rfidscan_hid = NULL;
+
+static const rfidscan_hid_backend* rfidscan_findBackend(const char* name)
+{
+    int i;
+    for( i=0; i < (int)(sizeof(rfidscan_hid_backends)/sizeof(rfidscan_hid_backends[0])); i++ ) {
+        if( strcmp(rfidscan_hid_backends[i]->name, name) == 0 )
+            return rfidscan_hid_backends[i];
+    }
+    return NULL;
+}
+
+// backend in use, the first one unless RFIDSCAN_BACKEND names another
+static const rfidscan_hid_backend* rfidscan_hidBackend(void)
+{
+    const char* name;
+    if( rfidscan_hid == NULL ) {
+        name = getenv("RFIDSCAN_BACKEND");
+        if( name == NULL || (rfidscan_hid = rfidscan_findBackend(name)) == NULL )
+            rfidscan_hid = rfidscan_hid_backends[0];
+        LOG("rfidscan_hidBackend: %s\n", rfidscan_hid->name);
+    }
+    return rfidscan_hid;
+}
+
+#define hid_exit                      rfidscan_hidBackend()->exit
+#define hid_enumerate_ids             rfidscan_hidBackend()->enumerate_ids
+#define hid_free_enumeration          rfidscan_hidBackend()->free_enumeration
+#define hid_open                      rfidscan_hidBackend()->open
+#define hid_open_path                 rfidscan_hidBackend()->open_path
+#define hid_close                     rfidscan_hidBackend()->close
+#define hid_read_many                 rfidscan_hidBackend()->read_many
+#define hid_send_feature_report       rfidscan_hidBackend()->send_feature_report
+#define hid_get_feature_report        rfidscan_hidBackend()->get_feature_report
+#define hid_send_feature_report_async rfidscan_hidBackend()->send_feature_report_async
+#define hid_get_feature_report_async  rfidscan_hidBackend()->get_feature_report_async
+#define hid_handle_events             rfidscan_hidBackend()->handle_events
+#define hid_get_event_fd              rfidscan_hidBackend()->get_event_fd
+#define hid_get_fd                    rfidscan_hidBackend()->get_fd
+#define hid_hotplug_register          rfidscan_hidBackend()->hotplug_register
+#define hid_hotplug_deregister        rfidscan_hidBackend()->hotplug_deregister
+#define hid_error                     rfidscan_hidBackend()->error
+#endif
+
+static const int rfidscan_pids[] = {
+  0x7241, /* Prox'N'Roll RFID Scanner */
+  0x9241, /* Prox'N'Roll RFID Scanner HSP */
+};
+
+#ifdef __linux__
+// epoll set waited for by rfidscan_handleEvents(): hid_get_event_fd(), with
+// a NULL data.ptr, and the fd of each device given to rfidscan_watchInput()
+// with the device as data.ptr
+static int rfidscan_epoll_fd = -1;
+static int rfidscan_epoll_event_fd = -1;  // hid_get_event_fd() in the set
+static pthread_mutex_t rfidscan_epoll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define rfidscan_epoll_batch 16  // events taken by one epoll_wait()
+#define rfidscan_input_batch 16  // reports taken by one hid_read_many()
+
+// create the epoll set, and add hid_get_event_fd() to it once it exists
+// resync adds it again, after the hotplug monitor has been replaced
+static int rfidscan_epollSetup(int resync)
+{
+    struct epoll_event ev;
+    int fd, rc = 0;
+
+    pthread_mutex_lock( &rfidscan_epoll_lock );
+    if( rfidscan_epoll_fd < 0 )
+        rfidscan_epoll_fd = epoll_create1( EPOLL_CLOEXEC );
+    if( rfidscan_epoll_fd < 0 ) {
+        rc = -1;
+    }
+    else {
+        if( resync ) rfidscan_epoll_event_fd = -1;
+        fd = hid_get_event_fd();
+        if( fd >= 0 && fd != rfidscan_epoll_event_fd ) {
+            memset( &ev, 0, sizeof(ev) );
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            if( epoll_ctl( rfidscan_epoll_fd, EPOLL_CTL_ADD, fd, &ev ) == 0 || errno == EEXIST )
+                rfidscan_epoll_event_fd = fd;
+        }
+    }
+    pthread_mutex_unlock( &rfidscan_epoll_lock );
+    return rc;
+}
+
+// take the fd of dev out of the epoll set, before it is closed
+static void rfidscan_epollRemove(rfidscan_device* dev)
+{
+    int fd = hid_get_fd(dev);
+    if( fd >= 0 && rfidscan_epoll_fd >= 0 )
+        epoll_ctl( rfidscan_epoll_fd, EPOLL_CTL_DEL, fd, NULL );
+}
+
+// pass the input reports queued by a watched device to its callback
+// dev comes from the epoll event: it is only used once the cache has
+// confirmed it is still opened and watched, and held until the end
+static int rfidscan_dispatchInput(rfidscan_device* dev)
+{
+    unsigned char data[rfidscan_input_batch][rfidscan_buf_size];
+    size_t lengths[rfidscan_input_batch];
+    rfidscan_input_cb callback;
+    void* user_data = NULL;
+    int i, n;
+
+    callback = rfidscan_retainInputCb( dev, &user_data );
+    if( callback == NULL ) return 0; // unwatched or closed meanwhile
+
+    n = hid_read_many( dev, &data[0][0], rfidscan_buf_size, lengths, rfidscan_input_batch, 0 );
+    if( n < 0 ) {
+        LOG("rfidscan_dispatchInput: device gone\n");
+        rfidscan_unwatchInput( dev );
+        callback( dev, NULL, -1, user_data );
+        n = 1;
+    }
+    else {
+        for( i=0; i < n; i++ )
+            callback( dev, data[i], (int) lengths[i], user_data );
+    }
+    rfidscan_close( dev );
+    return n;
+}
+#else
+#define rfidscan_epollRemove(dev)
+#endif
+
+static void rfidscan_asyncForget(rfidscan_device* dev);
+
+// close the handles kept open by rfidscan_setKeepOpen() that nobody uses
+static void rfidscan_closeIdleDevs(int stale_only)
+{
+    rfidscan_device* dev;
+    while( (dev = rfidscan_takeIdleDev(stale_only)) != NULL ) {
+        rfidscan_epollRemove(dev);
+        rfidscan_asyncForget(dev);
+        hid_close(dev);
+    }
+}
+
 int rfidscan_enumerate(void)
 {
   LOG("rfidscan_enumerate!\n");
-  rfidscan_cached_count = 0;
-  rfidscan_enumerateByVidPid(0x1C34, 0x7241); /* Prox'N'Roll RFID Scanner */
-  rfidscan_enumerateByVidPid(0x1C34, 0x9241); /* Prox'N'Roll RFID Scanner HSP */    
-  return rfidscan_cached_count;
+  rfidscan_markCache();
+  rfidscan_enumerateByVidPids(0x1C34, rfidscan_pids, sizeof(rfidscan_pids)/sizeof(rfidscan_pids[0]));
+  rfidscan_closeIdleDevs(1);
+  rfidscan_sweepCache();
+  return rfidscan_getCachedCount();
 }
 
 // get all matching devices by VID/PID pair
 int rfidscan_enumerateByVidPid(int vid, int pid)
+{
+    return rfidscan_enumerateByVidPids(vid, &pid, 1);
+}
+
+// get all matching devices by VID and a table of PIDs, in one walk of the bus
+int rfidscan_enumerateByVidPids(int vid, const int pids[], int pid_count)
 {
     struct hid_device_info *devs, *cur_dev;
+    struct hid_device_id *ids;
+    rfidscan_info *info;
 
     int i, count=0; 
-    devs = hid_enumerate(vid, pid);
+
+    if( pid_count <= 0 ) return 0;
+    ids = malloc( pid_count * sizeof(struct hid_device_id) );
+    if( ids == NULL ) return 0;
+    for( i=0; i<pid_count; i++ ) {
+        ids[i].vendor_id = vid;
+        ids[i].product_id = pids[i];
+    }
+
+    devs = hid_enumerate_ids(ids, pid_count);
+    free(ids);
+
     cur_dev = devs;    
+    rfidscan_wrlock();
     while (cur_dev) {
         if( (cur_dev->vendor_id != 0 && cur_dev->product_id != 0) &&  
-            (cur_dev->vendor_id == vid && cur_dev->product_id == pid) ) { 
+            (cur_dev->vendor_id == vid) ) { 
             if( cur_dev->serial_number != NULL ) { // can happen if not root
-                uint32_t serialnum;
-                strcpy( rfidscan_infos[rfidscan_cached_count+count].path,   cur_dev->path );
-                sprintf( rfidscan_infos[rfidscan_cached_count+count].serial, "%ls", cur_dev->serial_number);
-                //wcscpy( rfidscan_infos[rfidscan_cached_count+count].serial, cur_dev->serial_number );
-                //uint32_t sn = wcstol( cur_dev->serial_number, NULL, 16);
-                serialnum = strtol( rfidscan_infos[rfidscan_cached_count+count].serial, NULL, 16);
-                rfidscan_infos[rfidscan_cached_count+count].vid = vid;
-                rfidscan_infos[rfidscan_cached_count+count].pid = pid;
+                info = rfidscan_putInfo( cur_dev->path );
+                if( info == NULL ) break;
+                snprintf( info->serial, serialstrmax, "%ls", cur_dev->serial_number);
+                info->vid = vid;
+                info->pid = cur_dev->product_id;
+                info->stale = 0;
 
+                LOG("rfidscan_enumerateByVidPids: serial=%s path=%s\n", info->serial, info->path);
                 count++;
             }
         }
         cur_dev = cur_dev->next;
     }
+    rfidscan_sortCache();
+    rfidscan_wrunlock();
     hid_free_enumeration(devs);
 
-    LOG("rfidscan_enumerateByVidPid: done, %d devices found\n", count);
-    for( i=0; i<count; i++ ) { 
-        LOG("rfidscan_enumerateByVidPid: rfidscan_infos[%d].serial=%s\n",
-            i, rfidscan_infos[rfidscan_cached_count+i].serial);
-    }
-    rfidscan_cached_count += count;
-    rfidscan_sortCache();
+    LOG("rfidscan_enumerateByVidPids: done, %d devices found\n", count);
 
     return count;
 }
 
+static rfidscan_hotplug_cb rfidscan_hotplug_callback = NULL;
+static void* rfidscan_hotplug_user_data = NULL;
+
+// called from hid_handle_events() with the interfaces of the device
+static void HID_API_CALL rfidscan_hotplugEvent(int event, struct hid_device_info *devs, void *user_data)
+{
+    struct hid_device_info *cur_dev;
+    rfidscan_info *info;
+    char serial[serialstrmax];
+
+    for( cur_dev = devs; cur_dev != NULL; cur_dev = cur_dev->next ) {
+        if( event == HID_HOTPLUG_LEFT ) {
+            rfidscan_dropInfo( cur_dev->path, serial );
+            if( serial[0] == '\0' ) continue; // not one of ours
+            rfidscan_closeIdleDevs(1);
+        }
+        else {
+            if( cur_dev->serial_number == NULL ) continue; // can happen if not root
+            rfidscan_wrlock();
+            info = rfidscan_putInfo( cur_dev->path );
+            if( info != NULL ) {
+                snprintf( info->serial, serialstrmax, "%ls", cur_dev->serial_number);
+                info->vid = cur_dev->vendor_id;
+                info->pid = cur_dev->product_id;
+                info->stale = 0;
+                rfidscan_resetShadow( info ); // plugged in again, maybe changed
+                strcpy( serial, info->serial );
+                rfidscan_sortCache();
+            }
+            rfidscan_wrunlock();
+            if( info == NULL ) continue;
+        }
+
+        LOG("rfidscan_hotplugEvent: %s serial=%s path=%s\n",
+            (event == HID_HOTPLUG_LEFT) ? "left" : "arrived", serial, cur_dev->path);
+        if( rfidscan_hotplug_callback )
+            rfidscan_hotplug_callback( (event == HID_HOTPLUG_LEFT) ?
+                                       rfidscan_hotplug_left : rfidscan_hotplug_arrived,
+                                       serial, rfidscan_hotplug_user_data );
+    }
+}
+
+int rfidscan_hotplugRegister(rfidscan_hotplug_cb callback, void *user_data)
+{
+    struct hid_device_id ids[sizeof(rfidscan_pids)/sizeof(rfidscan_pids[0])];
+    int i;
+
+    for( i=0; i < (int)(sizeof(ids)/sizeof(ids[0])); i++ ) {
+        ids[i].vendor_id = 0x1C34;
+        ids[i].product_id = rfidscan_pids[i];
+    }
+    rfidscan_hotplug_callback = callback;
+    rfidscan_hotplug_user_data = user_data;
+
+    if( hid_hotplug_register( ids, sizeof(ids)/sizeof(ids[0]), rfidscan_hotplugEvent, NULL ) < 0 )
+        return -1;
+#ifdef __linux__
+    rfidscan_epollSetup(1); // the hotplug monitor may have a new fd
+#endif
+    return 0;
+}
+
+void rfidscan_hotplugDeregister(void)
+{
+    hid_hotplug_deregister();
+    rfidscan_hotplug_callback = NULL;
+    rfidscan_hotplug_user_data = NULL;
+#ifdef __linux__
+    rfidscan_epollSetup(1);
+#endif
+}
+
 //
 rfidscan_device* rfidscan_openByPath(const char* path)
 {
-  int i;
   rfidscan_device* handle;
+  rfidscan_device* cached;
 
     if( path == NULL || strlen(path) == 0 ) return NULL;
 
     LOG("rfidscan_openByPath: %s\n", path);
 
+    handle = rfidscan_retainCacheDev( path );
+    if( handle ) {
+        LOG("rfidscan_openByPath: reusing opened handle\n");
+        return handle;
+    }
+
     handle = hid_open_path( path ); 
 
-    i = rfidscan_getCacheIndexByPath( path );
-    if( i >= 0 ) {  // good
-        rfidscan_infos[i].dev = handle;
+    if( handle ) { 
+        cached = rfidscan_setCacheDev( path, handle );
+        if( cached != handle ) { // another thread opened it meanwhile
+            hid_close( handle );
+            handle = cached;
+        }
     }
-    else { // uh oh, not in cache, now what?
+    else { // the interface may have just been claimed by another thread
+        handle = rfidscan_retainCacheDev( path );
     }
     
     return handle;
@@ -74,15 +325,19 @@ rfidscan_device* rfidscan_openByPath(const char* path)
 rfidscan_device* rfidscan_openBySerial(const char* serial)
 {
     wchar_t wserialstr[serialstrmax] = {L'\0'};
+    char path[pathstrmax] = {'\0'};
     rfidscan_device* handle;
-    int i;
+    int vid = 0, pid = 0;
 
     if( serial == NULL || strlen(serial) == 0 ) return NULL;
 
-    i = rfidscan_getCacheIndexBySerial(serial);
-
     LOG("rfidscan_openBySerial: %s\n", serial);
-    LOG("rfidscan_openBySerial: id=%d\n", i );
+
+    if( rfidscan_copyCached( -1, serial, path, &vid, &pid ) == 0 ) {
+        LOG("rfidscan_openBySerial: good, serial %s was in cache\n", serial);
+        return rfidscan_openByPath( path );
+    }
+    LOG("rfidscan_openBySerial: uh oh, serial %s was NOT IN CACHE\n", serial);
 
 #ifdef _WIN32   // omg windows you suck
     swprintf( wserialstr, serialstrmax, L"%S", serial); // convert to wchar_t*
@@ -90,18 +345,9 @@ rfidscan_device* rfidscan_openBySerial(const char* serial)
     swprintf( wserialstr, serialstrmax, L"%s", serial); // convert to wchar_t*
 #endif
 
-    handle = hid_open(rfidscan_getCachedVid(i), rfidscan_getCachedPid(i), wserialstr ); 
+    handle = hid_open( vid, pid, wserialstr ); 
     if( handle ) LOG("rfidscan_openBySerial: got a rfidscan_device handle\n"); 
 
-    i = rfidscan_getCacheIndexBySerial( serial );
-    if( i >= 0 ) {
-        LOG("rfidscan_openBySerial: good, serial id:%d was in cache\n",i);
-        rfidscan_infos[i].dev = handle;
-    }
-    else { // uh oh, not in cache, now what?
-        LOG("rfidscan_openBySerial: uh oh, serial id:%d was NOT IN CACHE\n",i);
-    }
-
     return handle;
 }
 
@@ -115,7 +361,9 @@ rfidscan_device* rfidscan_openById( uint32_t i )
         return rfidscan_openBySerial( serialstr );  
     } 
     else {
-        return rfidscan_openByPath( rfidscan_getCachedPath(i) );
+        char path[pathstrmax];
+        if( rfidscan_copyCached( i, NULL, path, NULL, NULL ) < 0 ) return NULL;
+        return rfidscan_openByPath( path );
     }
 }
 
@@ -130,40 +378,517 @@ rfidscan_device* rfidscan_open(void)
 // FIXME: search through rfidscans list to zot it too?
 void rfidscan_close( rfidscan_device* dev )
 {
-    if( dev != NULL ) {
-        rfidscan_clearCacheDev(dev); // FIXME: hmmm 
+    // the handle stays open while other rfidscan_open*() calls still use it
+    if( dev != NULL && rfidscan_releaseCacheDev(dev) ) {
+        rfidscan_epollRemove(dev);
+        rfidscan_asyncForget(dev);
         hid_close(dev);
     }
     dev = NULL;
     //hid_exit(); // FIXME: this cleans up libusb in a way that hid_close doesn't
 }
 
-int rfidscan_exchange(rfidscan_device* dev, unsigned char *buf, int len)
+void rfidscan_setKeepOpen(int keep)
+{
+    rfidscan_keep_open = keep;
+    if( !keep ) rfidscan_closeIdleDevs(0);
+}
+
+void rfidscan_closeIdle(void)
+{
+    rfidscan_closeIdleDevs(0);
+}
+
+#ifdef RFIDSCAN_HID_BACKENDS
+int rfidscan_setBackend(const char* name)
+{
+    const rfidscan_hid_backend* backend = rfidscan_findBackend(name);
+
+    if( backend == NULL ) return -1;
+    if( backend == rfidscan_hidBackend() ) return 0;
+
+    // the handles and the paths in cache belong to the current backend
+    rfidscan_closeIdleDevs(0);
+    if( rfidscan_getOpenCount() > 0 ) {
+        LOG("rfidscan_setBackend: devices still open\n");
+        return -1;
+    }
+    hid_hotplug_deregister();
+    rfidscan_markCache();
+    rfidscan_sweepCache();
+
+    rfidscan_hid = backend;
+    LOG("rfidscan_setBackend: %s\n", rfidscan_hid->name);
+    return 0;
+}
+
+const char* rfidscan_getBackend(void)
+{
+    return rfidscan_hidBackend()->name;
+}
+#else
+int rfidscan_setBackend(const char* name)
+{
+    return -1; // only one backend built in
+}
+
+const char* rfidscan_getBackend(void)
+{
+    return "hidapi";
+}
+#endif
+
+// bounds of the growing backoff used by rfidscan_exchange_poll, in millis
+#define rfidscan_poll_backoff_min  1
+#define rfidscan_poll_backoff_max  16
+#define rfidscan_poll_timeout      1000
+
+// tell whether buf holds the answer to cmd, or if the device is still busy
+// (a device that has not answered yet gives back an empty frame, or our own
+// command unchanged). The firmware does not echo the sequence number, byte 3
+// of an answer is the status of a SET: with one command pending per device,
+// the answer read back can only be the one to that command.
+static int rfidscan_isAnswer(const uint8_t *cmd, const uint8_t *buf, int len)
+{
+  if( buf[1] < 3 || buf[1] > rfidscan_report_size-1 )
+    return 0;
+  if( memcmp(cmd, buf, len) == 0 )
+    return 0;
+  return 1;
+}
+
+// give the command a host-side sequence number, and keep a copy to match the
+// answer. The frame itself is left untouched, byte 2 stays 0 on the wire.
+static int rfidscan_stampCommand(rfidscan_info *info, unsigned char *buf, int len)
 {
+  if( len > (int) sizeof(info->cmd) )
+    return -1;
+
+  // 1..255, 0 is kept for devices not in cache
+  info->seq = (info->seq == 0xFF) ? 1 : info->seq + 1;
+
+  memcpy(info->cmd, buf, len);
+  info->cmd_len = len;
+  info->pending = info->seq;
+  info->submitted = rfidscan_millis();
+  return info->seq;
+}
+
+int rfidscan_exchangeSubmit(rfidscan_device* dev, unsigned char *buf, int len)
+{
+  rfidscan_info *info;
+  int seq;
   int rc;
-  
+
   if( dev==NULL )
   {
     return -1; // RFIDSCAN_ERR_NOTOPEN;
   }
+
+  seq = 0;
+  info = rfidscan_getInfo( dev );
+  if( info != NULL )
+  {
+    seq = rfidscan_stampCommand( info, buf, len );
+    if( seq < 0 )
+      return -1;
+  }
+
   rc = hid_send_feature_report( dev, buf, len );
   // FIXME: put this in an ifdef?
   if( rc==-1 )
   {
     LOG("rfidscan_write error: %ls\n", hid_error(dev));
+    if( info != NULL ) info->pending = 0;
     return rc;
   }
-  
-  rfidscan_sleep(120); //FIXME:
 
-  LOG("get_feature_report\n");
-  
-  if( (rc = hid_get_feature_report(dev, buf, len) == -1) )
+  return seq;
+}
+
+int rfidscan_exchangeComplete(rfidscan_device* dev, int seq, unsigned char *buf, int len)
+{
+  rfidscan_info *info;
+  uint16_t backoff = rfidscan_poll_backoff_min;
+  int elapsed;
+  int rc;
+
+  if( dev==NULL )
   {
-    LOG("error reading data: %d\n", rc);
+    return -1; // RFIDSCAN_ERR_NOTOPEN;
+  }
+
+  info = rfidscan_getInfo( dev );
+  if( info == NULL )
+  {
+    // not in cache, so nothing to match the answer against
+    rfidscan_sleep(120); //FIXME:
+    LOG("get_feature_report\n");
+    if( (rc = hid_get_feature_report(dev, buf, len)) == -1 )
+      LOG("error reading data: %d\n", rc);
     return rc;
   }
 
+  if( seq <= 0 || info->pending != seq )
+  {
+    LOG("no command pending with seq %d\n", seq);
+    return -1;
+  }
+  if( len > info->cmd_len )
+    len = info->cmd_len;
+
+  if( info->exchange_mode == rfidscan_exchange_fixed )
+  {
+    elapsed = (int) (rfidscan_millis() - info->submitted);
+    if( elapsed < 120 )
+      rfidscan_sleep(120 - elapsed); //FIXME:
+    backoff = 0;
+  }
+
+  for(;;)
+  {
+    if( backoff )
+      rfidscan_sleep(backoff);
+
+    LOG("get_feature_report\n");
+    memcpy(buf, info->cmd, len);
+    rc = hid_get_feature_report(dev, buf, len);
+    elapsed = (int) (rfidscan_millis() - info->submitted);
+
+    if( rc > 0 && rfidscan_isAnswer(info->cmd, buf, len) )
+      break;
+
+    if( elapsed >= rfidscan_poll_timeout )
+    {
+      LOG("no answer after %d ms\n", elapsed);
+      info->pending = 0;
+      return -1;
+    }
+
+    backoff = (backoff == 0) ? rfidscan_poll_backoff_min : backoff * 2;
+    if( backoff > rfidscan_poll_backoff_max )
+      backoff = rfidscan_poll_backoff_max;
+  }
+
+  LOG("get_feature_report: answer to seq %d after %d ms\n", seq, elapsed);
+  info->pending = 0;
+  info->exchange_ms = elapsed;
   return rc;
 }
 
+int rfidscan_exchange(rfidscan_device* dev, unsigned char *buf, int len)
+{
+  int seq;
+
+  seq = rfidscan_exchangeSubmit(dev, buf, len);
+  if( seq < 0 )
+    return seq;
+
+  return rfidscan_exchangeComplete(dev, seq, buf, len);
+}
+
+// state of an exchange driven by rfidscan_exchangeAsync(). The completions
+// may run after the device is closed and its cache entry freed, so the
+// command and its time are copied here rather than read from the entry
+typedef struct rfidscan_async_ {
+  rfidscan_device* dev;
+  uint8_t *buf;
+  int len;
+  int seq;
+  uint8_t cmd[rfidscan_buf_size];
+  uint32_t submitted;
+  rfidscan_exchange_cb callback;
+  void *user_data;
+  uint16_t backoff;   // delay before the next poll, as in rfidscan_exchangeComplete
+  uint32_t due;       // rfidscan_millis() of the next poll
+  struct rfidscan_async_ *next;
+} rfidscan_async;
+
+// exchanges waiting for their next poll, resubmitted by rfidscan_handleEvents()
+static rfidscan_async *rfidscan_async_waiting = NULL;
+
+static void rfidscan_asyncFinish(rfidscan_async *a, int rc)
+{
+  if( a->dev != NULL )
+    rfidscan_endExchange(a->dev, a->seq, (rc >= 0) ? (int) (rfidscan_millis() - a->submitted) : -1);
+
+  a->callback(a->dev, rc, a->buf, a->user_data);
+  free(a);
+}
+
+static void HID_API_CALL rfidscan_asyncGetDone(hid_device *dev, int res, unsigned char *data, void *user_data)
+{
+  rfidscan_async *a = user_data;
+
+  // closed under the exchange, a->dev may already be reused
+  if( dev == NULL )
+    a->dev = NULL;
+
+  if( a->dev == NULL || !rfidscan_isPending(a->dev, a->seq) )
+  {
+    rfidscan_asyncFinish(a, -1);
+    return;
+  }
+
+  if( res > 0 && rfidscan_isAnswer(a->cmd, a->buf, a->len) )
+  {
+    LOG("get_feature_report: answer to seq %d\n", a->seq);
+    rfidscan_asyncFinish(a, res);
+    return;
+  }
+
+  if( (int) (rfidscan_millis() - a->submitted) >= rfidscan_poll_timeout )
+  {
+    LOG("no answer to seq %d\n", a->seq);
+    rfidscan_asyncFinish(a, -1);
+    return;
+  }
+
+  // not there yet, ask again once the backoff has elapsed
+  a->backoff = (a->backoff == 0) ? rfidscan_poll_backoff_min : a->backoff * 2;
+  if( a->backoff > rfidscan_poll_backoff_max )
+    a->backoff = rfidscan_poll_backoff_max;
+  a->due = rfidscan_millis() + a->backoff;
+
+  rfidscan_wrlock();
+  a->next = rfidscan_async_waiting;
+  rfidscan_async_waiting = a;
+  rfidscan_wrunlock();
+}
+
+// poll again the exchanges whose backoff has elapsed, or whose device was
+// closed meanwhile, and tell how long until the next one is due (-1 if none)
+static int rfidscan_asyncPoll(void)
+{
+  rfidscan_async *due = NULL;
+  rfidscan_async **cur;
+  rfidscan_async *a;
+  uint32_t now = rfidscan_millis();
+  int left, wait = -1;
+
+  rfidscan_wrlock();
+  cur = &rfidscan_async_waiting;
+  while( (a = *cur) != NULL )
+  {
+    left = (int) (a->due - now);
+    if( a->dev == NULL || left <= 0 )
+    {
+      *cur = a->next;
+      a->next = due;
+      due = a;
+      continue;
+    }
+    if( wait < 0 || left < wait )
+      wait = left;
+    cur = &a->next;
+  }
+  rfidscan_wrunlock();
+
+  while( (a = due) != NULL )
+  {
+    due = a->next;
+    if( a->dev == NULL || !rfidscan_isPending(a->dev, a->seq) )
+    {
+      rfidscan_asyncFinish(a, -1);
+      continue;
+    }
+    memcpy(a->buf, a->cmd, a->len);
+    if( hid_get_feature_report_async(a->dev, a->buf, a->len, rfidscan_asyncGetDone, a) < 0 )
+      rfidscan_asyncFinish(a, -1);
+  }
+  return wait;
+}
+
+// the exchanges of dev waiting for their next poll are finished with -1
+// by the next rfidscan_handleEvents(), dev is about to be closed
+static void rfidscan_asyncForget(rfidscan_device* dev)
+{
+  rfidscan_async *a;
+
+  rfidscan_wrlock();
+  for( a = rfidscan_async_waiting; a != NULL; a = a->next )
+  {
+    if( a->dev == dev )
+      a->dev = NULL;
+  }
+  rfidscan_wrunlock();
+}
+
+static void HID_API_CALL rfidscan_asyncSetDone(hid_device *dev, int res, unsigned char *data, void *user_data)
+{
+  rfidscan_async *a = user_data;
+
+  if( dev == NULL )
+    a->dev = NULL;
+
+  if( res < 0 )
+  {
+    LOG("rfidscan_write error\n");
+    rfidscan_asyncFinish(a, -1);
+    return;
+  }
+
+  if( hid_get_feature_report_async(a->dev, a->buf, a->len, rfidscan_asyncGetDone, a) < 0 )
+    rfidscan_asyncFinish(a, -1);
+}
+
+int rfidscan_exchangeAsync(rfidscan_device* dev, unsigned char *buf, int len, rfidscan_exchange_cb callback, void *user_data)
+{
+  rfidscan_async *a;
+  rfidscan_info *info;
+
+  if( dev==NULL || callback==NULL )
+  {
+    return -1; // RFIDSCAN_ERR_NOTOPEN;
+  }
+
+  // the answer can only be matched for a device in cache
+  info = rfidscan_getInfo( dev );
+  if( info == NULL )
+    return -1;
+
+  if( info->pending )
+  {
+    LOG("rfidscan_exchangeAsync: seq %d still pending\n", info->pending);
+    return -1;
+  }
+
+  a = calloc(1, sizeof(rfidscan_async));
+  if( a == NULL )
+    return -1;
+  a->dev = dev;
+  a->buf = buf;
+  a->len = len;
+  a->callback = callback;
+  a->user_data = user_data;
+
+  a->seq = rfidscan_stampCommand( info, buf, len );
+  if( a->seq < 0 )
+  {
+    free(a);
+    return -1;
+  }
+  memcpy(a->cmd, buf, len);
+  a->submitted = rfidscan_millis();
+
+  if( hid_send_feature_report_async(dev, buf, len, rfidscan_asyncSetDone, a) < 0 )
+  {
+    info->pending = 0;
+    free(a);
+    return -1;
+  }
+
+  return a->seq;
+}
+
+int rfidscan_handleEvents(int milliseconds)
+{
+#ifdef __linux__
+  struct epoll_event events[rfidscan_epoll_batch];
+  int i, n, rc, count = 0;
+#endif
+  int wait;
+
+  // do not sleep past the next poll of an exchange
+  wait = rfidscan_asyncPoll();
+  if( wait >= 0 && (milliseconds < 0 || wait < milliseconds) )
+    milliseconds = wait;
+
+#ifdef __linux__
+  if( rfidscan_epollSetup(0) < 0 )
+    return hid_handle_events(milliseconds);
+
+  // one wait for the transfers, the hotplug events and all the watched devices
+  n = epoll_wait(rfidscan_epoll_fd, events, rfidscan_epoll_batch, milliseconds);
+  if( n < 0 && errno != EINTR )
+    return -1;
+
+  for( i=0; i < n; i++ )
+  {
+    if( events[i].data.ptr != NULL )
+      count += rfidscan_dispatchInput( events[i].data.ptr );
+  }
+
+  rc = hid_handle_events(0);
+  if( rc > 0 )
+    count += rc;
+  return count;
+#else
+  return hid_handle_events(milliseconds);
+#endif
+}
+
+int rfidscan_getEventTimeout(void)
+{
+  rfidscan_async *a;
+  uint32_t now = rfidscan_millis();
+  int left, wait = -1;
+
+  rfidscan_rdlock();
+  for( a = rfidscan_async_waiting; a != NULL; a = a->next )
+  {
+    left = (a->dev == NULL) ? 0 : (int) (a->due - now);
+    if( left < 0 )
+      left = 0;
+    if( wait < 0 || left < wait )
+      wait = left;
+  }
+  rfidscan_rdunlock();
+  return wait;
+}
+
+int rfidscan_getEventFd(void)
+{
+#ifdef __linux__
+  // the epoll set is readable when any of its descriptors is
+  if( rfidscan_epollSetup(0) == 0 )
+    return rfidscan_epoll_fd;
+#endif
+  return hid_get_event_fd();
+}
+
+#ifdef __linux__
+int rfidscan_watchInput(rfidscan_device* dev, rfidscan_input_cb callback, void *user_data)
+{
+  struct epoll_event ev;
+  int fd;
+
+  if( dev==NULL || callback==NULL )
+    return -1;
+
+  // the libusb backend has no descriptor per device
+  fd = hid_get_fd(dev);
+  if( fd < 0 || rfidscan_epollSetup(0) < 0 )
+    return -1;
+
+  if( rfidscan_setInputCb(dev, callback, user_data) < 0 )
+    return -1;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = dev;
+  if( epoll_ctl(rfidscan_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST )
+  {
+    rfidscan_setInputCb(dev, NULL, NULL);
+    return -1;
+  }
+  return 0;
+}
+
+void rfidscan_unwatchInput(rfidscan_device* dev)
+{
+  if( dev==NULL )
+    return;
+  rfidscan_epollRemove(dev);
+  rfidscan_setInputCb(dev, NULL, NULL);
+}
+#else
+int rfidscan_watchInput(rfidscan_device* dev, rfidscan_input_cb callback, void *user_data)
+{
+  return -1;
+}
+
+void rfidscan_unwatchInput(rfidscan_device* dev)
+{
+}
+#endif
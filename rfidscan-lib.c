@@ -18,6 +18,8 @@
 #define   swprintf   _snwprintf
 #else
 #include <unistd.h>    // for usleep()
+#include <time.h>      // for clock_gettime()
+#include <pthread.h>   // for pthread_rwlock_t
 #endif
 
 #include "rfidscan-lib.h"
@@ -47,20 +49,89 @@ static const uint8_t ACTION_SET_FEED = 0xA0;
 static const uint8_t ACTION_SET_MIFARE_KEY_E2 = 0xB0;
 
 
+// shadow of the FEED registers of a device, see rfidscan_setRegisterShadow()
+typedef struct rfidscan_shadow_ {
+    uint8_t valid[256/8];  // one bit per register address
+    uint8_t size[256];
+    uint8_t data[256][rfidscan_register_max];
+} rfidscan_shadow;
+
 // rfidscan copy of some hid_device_info and other bits. 
 // this seems kinda dumb, though. is there a better way?
 typedef struct rfidscan_info_ {
     rfidscan_device* dev;  // device, if opened, NULL otherwise
+    int refs;           // rfidscan_open*() calls not rfidscan_close()d yet
     char path[pathstrmax];  // platform-specific device path
     char serial[serialstrmax];
     int vid;
     int pid;
+    int stale;          // not seen (yet) by the enumeration in progress
+    int exchange_mode;  // rfidscan_exchange_fixed or rfidscan_exchange_poll
+    int exchange_ms;    // time taken by the last exchange, -1 if unknown
+    uint8_t seq;        // sequence number of the last command sent
+    uint8_t pending;    // sequence number of the command awaiting its answer
+    uint32_t submitted; // rfidscan_millis() when the pending command was sent
+    uint8_t cmd[rfidscan_buf_size]; // copy of the pending command
+    int cmd_len;
+    rfidscan_input_cb input_cb;     // set by rfidscan_watchInput()
+    void* input_user_data;
+    rfidscan_shadow* shadow;        // allocated on the first register read
+    struct rfidscan_info_* retired; // next in rfidscan_retired
 } rfidscan_info;
 
-static rfidscan_info rfidscan_infos[cache_max];
+// The device cache is a growable table of entries, each allocated on its
+// own so that pointers to them stay valid when the table grows or is
+// sorted. Lookups by path, serial and dev go through hash indexes rebuilt
+// whenever the table changes. Everything is protected by a reader-writer
+// lock: lookups only take it shared, so they run alongside each other, but
+// they still wait for an enumeration, an open or a close in progress.
+//
+// An entry is only freed while it has no opened handle, so the entry of a
+// device is pinned for as long as it is open. Entries dropped by a hotplug
+// event are retired, not freed, until the next rfidscan_enumerate(): the
+// strings returned by rfidscan_getCachedPath() stay valid until then.
+static rfidscan_info** rfidscan_infos = NULL;
 static int rfidscan_cached_count = 0;  // number of cached entities
+static int rfidscan_cached_size = 0;   // allocated size of rfidscan_infos
+static rfidscan_info* rfidscan_retired = NULL;  // dropped, freed by rfidscan_markCache()
+
+// hash index on the cache: slots hold (cache index + 1), 0 for a free slot
+typedef struct rfidscan_index_ {
+    int* slots;
+    uint32_t size;  // power of two
+} rfidscan_index;
+
+enum { rfidscan_key_path, rfidscan_key_serial, rfidscan_key_dev };
+
+static rfidscan_index rfidscan_byPath;
+static rfidscan_index rfidscan_bySerial;
+static rfidscan_index rfidscan_byDev;
+
+#ifdef _WIN32
+static SRWLOCK rfidscan_lock = SRWLOCK_INIT;
+#define rfidscan_rdlock() AcquireSRWLockShared(&rfidscan_lock)
+#define rfidscan_rdunlock() ReleaseSRWLockShared(&rfidscan_lock)
+#define rfidscan_wrlock() AcquireSRWLockExclusive(&rfidscan_lock)
+#define rfidscan_wrunlock() ReleaseSRWLockExclusive(&rfidscan_lock)
+#else
+static pthread_rwlock_t rfidscan_lock = PTHREAD_RWLOCK_INITIALIZER;
+#define rfidscan_rdlock() pthread_rwlock_rdlock(&rfidscan_lock)
+#define rfidscan_rdunlock() pthread_rwlock_unlock(&rfidscan_lock)
+#define rfidscan_wrlock() pthread_rwlock_wrlock(&rfidscan_lock)
+#define rfidscan_wrunlock() pthread_rwlock_unlock(&rfidscan_lock)
+#endif
 
 static int rfidscan_enable_degamma = 1;
+static int rfidscan_keep_open = 0;  // keep handles open once no longer used
+static int rfidscan_shadow_registers = 0;  // serve register reads from rfidscan_shadow
+
+// FEED registers each product can hold, see rfidscan_setRegisterMap()
+#define rfidscan_register_maps_max 8
+static struct {
+    int pid;
+    uint8_t map[rfidscan_register_map_size];
+} rfidscan_register_maps[rfidscan_register_maps_max];
+static int rfidscan_register_map_count = 0;
 
 // set in Makefile to debug HIDAPI stuff
 #define LOG(...) if (rfidscan_verbose) fprintf(stderr, __VA_ARGS__)
@@ -73,6 +144,441 @@ static int rfidscan_enable_degamma = 1;
 #define rfidscan_eeaddr_patternstart (rfidscan_eeaddr_serialnum + rfidscan_serialnum_len)
 
 void rfidscan_sortCache(void);
+static uint32_t rfidscan_millis(void);
+
+
+//----------------------------------------------------------------------------
+// device cache internals
+
+// FNV-1a
+static uint32_t rfidscan_hashString(const char* str)
+{
+    uint32_t h = 2166136261u;
+    while( *str ) {
+        h ^= (uint8_t) *str++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t rfidscan_hashKey(int kind, const void* key)
+{
+    if( kind == rfidscan_key_dev )
+        return (uint32_t) (((uintptr_t) key) >> 4) * 2654435761u;
+    return rfidscan_hashString( (const char*) key );
+}
+
+static int rfidscan_matchKey(int kind, const rfidscan_info* info, const void* key)
+{
+    switch( kind ) {
+    case rfidscan_key_path:   return strcmp( info->path, (const char*) key ) == 0;
+    case rfidscan_key_serial: return strcmp( info->serial, (const char*) key ) == 0;
+    default:                  return info->dev == (const rfidscan_device*) key;
+    }
+}
+
+static const void* rfidscan_infoKey(int kind, const rfidscan_info* info)
+{
+    switch( kind ) {
+    case rfidscan_key_path:   return info->path;
+    case rfidscan_key_serial: return info->serial;
+    default:                  return info->dev;
+    }
+}
+
+// must be called with rfidscan_lock held for writing
+static void rfidscan_rebuildIndex(rfidscan_index* index, int kind)
+{
+    uint32_t size = 32;
+    uint32_t h;
+    int i;
+
+    while( size < (uint32_t) rfidscan_cached_count * 2 )
+        size *= 2;
+    if( size != index->size ) {
+        free( index->slots );
+        index->slots = calloc( size, sizeof(int) );
+        index->size = (index->slots != NULL) ? size : 0;
+    }
+    else {
+        memset( index->slots, 0, size * sizeof(int) );
+    }
+    if( index->size == 0 ) return;
+
+    for( i=0; i < rfidscan_cached_count; i++ ) {
+        const void* key = rfidscan_infoKey( kind, rfidscan_infos[i] );
+        if( kind == rfidscan_key_dev && key == NULL ) continue; // not opened
+        h = rfidscan_hashKey( kind, key ) & (index->size - 1);
+        while( index->slots[h] != 0 )
+            h = (h + 1) & (index->size - 1);
+        index->slots[h] = i + 1;
+    }
+}
+
+// must be called with rfidscan_lock held
+static int rfidscan_lookup(const rfidscan_index* index, int kind, const void* key)
+{
+    uint32_t h;
+
+    if( index->size == 0 || key == NULL ) return -1;
+    h = rfidscan_hashKey( kind, key ) & (index->size - 1);
+    while( index->slots[h] != 0 ) {
+        int i = index->slots[h] - 1;
+        if( rfidscan_matchKey( kind, rfidscan_infos[i], key ) ) return i;
+        h = (h + 1) & (index->size - 1);
+    }
+    return -1;
+}
+
+// must be called with rfidscan_lock held for writing
+static void rfidscan_reindex(void)
+{
+    rfidscan_rebuildIndex( &rfidscan_byPath, rfidscan_key_path );
+    rfidscan_rebuildIndex( &rfidscan_bySerial, rfidscan_key_serial );
+    rfidscan_rebuildIndex( &rfidscan_byDev, rfidscan_key_dev );
+}
+
+// find the entry for path, or append a new one
+// must be called with rfidscan_lock held for writing, call rfidscan_reindex()
+// once done to index the new entries by serial
+static rfidscan_info* rfidscan_putInfo(const char* path)
+{
+    rfidscan_info* info;
+    int i = rfidscan_lookup( &rfidscan_byPath, rfidscan_key_path, path );
+
+    if( i >= 0 ) return rfidscan_infos[i];
+
+    if( rfidscan_cached_count == rfidscan_cached_size ) {
+        int size = rfidscan_cached_size ? rfidscan_cached_size * 2 : cache_max;
+        rfidscan_info** infos = realloc( rfidscan_infos, size * sizeof(rfidscan_info*) );
+        if( infos == NULL ) return NULL;
+        rfidscan_infos = infos;
+        rfidscan_cached_size = size;
+    }
+
+    info = calloc( 1, sizeof(rfidscan_info) );
+    if( info == NULL ) return NULL;
+    strncpy( info->path, path, pathstrmax-1 );
+    info->exchange_mode = rfidscan_exchange_fixed;
+    info->exchange_ms = -1;
+    rfidscan_infos[rfidscan_cached_count++] = info;
+
+    // keep the path index usable for the next rfidscan_putInfo()
+    if( (uint32_t) rfidscan_cached_count * 2 > rfidscan_byPath.size ) {
+        rfidscan_rebuildIndex( &rfidscan_byPath, rfidscan_key_path );
+    }
+    else {
+        uint32_t h = rfidscan_hashKey( rfidscan_key_path, path ) & (rfidscan_byPath.size - 1);
+        while( rfidscan_byPath.slots[h] != 0 )
+            h = (h + 1) & (rfidscan_byPath.size - 1);
+        rfidscan_byPath.slots[h] = rfidscan_cached_count;
+    }
+    return info;
+}
+
+static void rfidscan_freeInfo(rfidscan_info* info)
+{
+    free( info->shadow );
+    free( info );
+}
+
+// forget the registers of a device: they may have changed meanwhile
+static void rfidscan_resetShadow(rfidscan_info* info)
+{
+    if( info->shadow != NULL )
+        memset( info->shadow->valid, 0, sizeof(info->shadow->valid) );
+}
+
+// flag every entry as stale before an enumeration, and free the retired ones
+static void rfidscan_markCache(void)
+{
+    rfidscan_info* info;
+    int i;
+    rfidscan_wrlock();
+    for( i=0; i < rfidscan_cached_count; i++ )
+        rfidscan_infos[i]->stale = 1;
+    while( (info = rfidscan_retired) != NULL ) {
+        rfidscan_retired = info->retired;
+        rfidscan_freeInfo( info );
+    }
+    rfidscan_wrunlock();
+}
+
+// drop the entries the enumeration has not seen again, unless still opened
+static void rfidscan_sweepCache(void)
+{
+    int i, n = 0;
+    rfidscan_wrlock();
+    for( i=0; i < rfidscan_cached_count; i++ ) {
+        if( rfidscan_infos[i]->stale && rfidscan_infos[i]->dev == NULL )
+            rfidscan_freeInfo( rfidscan_infos[i] );
+        else
+            rfidscan_infos[n++] = rfidscan_infos[i];
+    }
+    rfidscan_cached_count = n;
+    rfidscan_reindex();
+    rfidscan_wrunlock();
+}
+
+// drop the entry of a device which has been unplugged, unless still opened
+// serial receives its serial number, empty if path is not in cache
+static void rfidscan_dropInfo(const char* path, char* serial)
+{
+    int i;
+    serial[0] = '\0';
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byPath, rfidscan_key_path, path );
+    if( i >= 0 ) {
+        strcpy( serial, rfidscan_infos[i]->serial );
+        if( rfidscan_infos[i]->dev == NULL ) {
+            rfidscan_infos[i]->retired = rfidscan_retired;
+            rfidscan_retired = rfidscan_infos[i];
+            memmove( &rfidscan_infos[i], &rfidscan_infos[i+1],
+                     (rfidscan_cached_count - i - 1) * sizeof(rfidscan_info*) );
+            rfidscan_cached_count--;
+            rfidscan_reindex();
+        }
+        else {
+            rfidscan_infos[i]->stale = 1; // swept by the next rfidscan_enumerate()
+        }
+    }
+    rfidscan_wrunlock();
+}
+
+// entry of an opened device, NULL if dev is not in cache. The entry is
+// pinned while dev is open: only the caller holding dev may use it once the
+// lock is released. Code that may run after dev is closed (the asynchronous
+// completions) copies what it needs under the lock instead
+static rfidscan_info* rfidscan_getInfo(rfidscan_device* dev)
+{
+    rfidscan_info* info = NULL;
+    int i;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) info = rfidscan_infos[i];
+    rfidscan_rdunlock();
+    return info;
+}
+
+// whether the command seq is still awaiting its answer on dev
+static int rfidscan_isPending(rfidscan_device* dev, int seq)
+{
+    int i, pending = 0;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) pending = (rfidscan_infos[i]->pending == seq);
+    rfidscan_rdunlock();
+    return pending;
+}
+
+// the command seq of dev got its answer after elapsed millis, or none (-1)
+static void rfidscan_endExchange(rfidscan_device* dev, int seq, int elapsed)
+{
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 && rfidscan_infos[i]->pending == seq ) {
+        rfidscan_infos[i]->pending = 0;
+        if( elapsed >= 0 ) rfidscan_infos[i]->exchange_ms = elapsed;
+    }
+    rfidscan_wrunlock();
+}
+
+// set the input callback of an opened device, -1 if dev is not in cache
+static int rfidscan_setInputCb(rfidscan_device* dev, rfidscan_input_cb callback, void* user_data)
+{
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) {
+        rfidscan_infos[i]->input_cb = callback;
+        rfidscan_infos[i]->input_user_data = user_data;
+    }
+    rfidscan_wrunlock();
+    return (i >= 0) ? 0 : -1;
+}
+
+// input callback of an opened device, NULL if none. When there is one, a
+// reference is taken on dev so that a concurrent rfidscan_close() cannot
+// close it under the caller, which releases it with rfidscan_close()
+static rfidscan_input_cb rfidscan_retainInputCb(rfidscan_device* dev, void** user_data)
+{
+    rfidscan_input_cb callback = NULL;
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 && rfidscan_infos[i]->input_cb != NULL ) {
+        callback = rfidscan_infos[i]->input_cb;
+        *user_data = rfidscan_infos[i]->input_user_data;
+        rfidscan_infos[i]->refs++;
+    }
+    rfidscan_wrunlock();
+    return callback;
+}
+
+// copy a register from the shadow of dev, as rfidscan_RegisterRead() would
+// return it, or -1 if it is not there
+static int rfidscan_shadowGet(rfidscan_device* dev, uint8_t addr, uint8_t data[], size_t max_size)
+{
+    rfidscan_shadow* shadow;
+    int i, rc = -1;
+    if( !rfidscan_shadow_registers ) return -1;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 && (shadow = rfidscan_infos[i]->shadow) != NULL &&
+        (shadow->valid[addr / 8] & (1 << (addr % 8))) ) {
+        rc = shadow->size[addr];
+        if( data != NULL )
+            memcpy( data, shadow->data[addr], ((size_t) rc < max_size) ? (size_t) rc : max_size );
+    }
+    rfidscan_rdunlock();
+    return rc;
+}
+
+// remember the value of a register, as read from the device or verified
+static void rfidscan_shadowPut(rfidscan_device* dev, uint8_t addr, const uint8_t data[], int size)
+{
+    rfidscan_shadow* shadow;
+    int i;
+    if( !rfidscan_shadow_registers || size < 0 || size > rfidscan_register_max ) return;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) {
+        if( rfidscan_infos[i]->shadow == NULL )
+            rfidscan_infos[i]->shadow = calloc( 1, sizeof(rfidscan_shadow) );
+        if( (shadow = rfidscan_infos[i]->shadow) != NULL ) {
+            memcpy( shadow->data[addr], data, size );
+            shadow->size[addr] = (uint8_t) size;
+            shadow->valid[addr / 8] |= (1 << (addr % 8));
+        }
+    }
+    rfidscan_wrunlock();
+}
+
+// forget a register of dev, or all of them if addr is -1
+static void rfidscan_shadowDrop(rfidscan_device* dev, int addr)
+{
+    rfidscan_shadow* shadow;
+    int i;
+    if( !rfidscan_shadow_registers ) return;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 && (shadow = rfidscan_infos[i]->shadow) != NULL ) {
+        if( addr < 0 )
+            rfidscan_resetShadow( rfidscan_infos[i] );
+        else
+            shadow->valid[addr / 8] &= ~(1 << (addr % 8));
+    }
+    rfidscan_wrunlock();
+}
+
+// copy the path, vid and pid of cache index i, or of serial if not NULL,
+// in one go so that the entry cannot change in between. -1 if not found
+static int rfidscan_copyCached(int i, const char* serial, char path[pathstrmax], int* vid, int* pid)
+{
+    int rc = -1;
+    rfidscan_rdlock();
+    if( serial != NULL )
+        i = rfidscan_lookup( &rfidscan_bySerial, rfidscan_key_serial, serial );
+    if( i >= 0 && i < rfidscan_cached_count ) {
+        strcpy( path, rfidscan_infos[i]->path );
+        if( vid != NULL ) *vid = rfidscan_infos[i]->vid;
+        if( pid != NULL ) *pid = rfidscan_infos[i]->pid;
+        rc = 0;
+    }
+    rfidscan_rdunlock();
+    return rc;
+}
+
+// take a reference on the handle already opened for path, NULL if none
+static rfidscan_device* rfidscan_retainCacheDev(const char* path)
+{
+    rfidscan_device* dev = NULL;
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byPath, rfidscan_key_path, path );
+    if( i >= 0 && rfidscan_infos[i]->dev != NULL ) {
+        dev = rfidscan_infos[i]->dev;
+        rfidscan_infos[i]->refs++;
+    }
+    rfidscan_wrunlock();
+    return dev;
+}
+
+// attach a newly opened device to the cache entry of path, with one
+// reference. Another thread may have opened the same device meanwhile:
+// its handle is then returned instead, and dev must be closed
+static rfidscan_device* rfidscan_setCacheDev(const char* path, rfidscan_device* dev)
+{
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byPath, rfidscan_key_path, path );
+    if( i >= 0 ) {
+        if( rfidscan_infos[i]->dev == NULL ) {
+            rfidscan_infos[i]->dev = dev;
+            rfidscan_infos[i]->input_cb = NULL;
+            rfidscan_resetShadow( rfidscan_infos[i] );
+            rfidscan_rebuildIndex( &rfidscan_byDev, rfidscan_key_dev );
+        }
+        dev = rfidscan_infos[i]->dev;
+        rfidscan_infos[i]->refs++;
+    }
+    rfidscan_wrunlock();
+    return dev;
+}
+
+// drop a reference on dev, return 1 if the handle must now be closed
+static int rfidscan_releaseCacheDev(rfidscan_device* dev)
+{
+    int i, release = 1;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) {
+        if( rfidscan_infos[i]->refs > 0 ) rfidscan_infos[i]->refs--;
+        if( rfidscan_infos[i]->refs > 0 || rfidscan_keep_open ) {
+            release = 0;
+        }
+        else {
+            rfidscan_infos[i]->dev = NULL;
+            rfidscan_rebuildIndex( &rfidscan_byDev, rfidscan_key_dev );
+        }
+    }
+    rfidscan_wrunlock();
+    return release;
+}
+
+// detach an opened handle nobody uses any more, NULL if there is none
+// stale_only restricts it to the devices not seen by the last enumeration
+static rfidscan_device* rfidscan_takeIdleDev(int stale_only)
+{
+    rfidscan_device* dev = NULL;
+    int i;
+    rfidscan_wrlock();
+    for( i=0; i < rfidscan_cached_count; i++ ) {
+        rfidscan_info* info = rfidscan_infos[i];
+        if( info->dev != NULL && info->refs == 0 && (info->stale || !stale_only) ) {
+            dev = info->dev;
+            info->dev = NULL;
+            rfidscan_rebuildIndex( &rfidscan_byDev, rfidscan_key_dev );
+            break;
+        }
+    }
+    rfidscan_wrunlock();
+    return dev;
+}
+
+#ifdef RFIDSCAN_HID_BACKENDS
+// number of devices with an opened handle, for rfidscan_setBackend()
+static int rfidscan_getOpenCount(void)
+{
+    int i, count = 0;
+    rfidscan_rdlock();
+    for( i=0; i < rfidscan_cached_count; i++ )
+        if( rfidscan_infos[i]->dev != NULL ) count++;
+    rfidscan_rdunlock();
+    return count;
+}
+#endif
 
 
 //----------------------------------------------------------------------------
@@ -95,41 +601,59 @@ void rfidscan_sortCache(void);
 //
 int rfidscan_getCachedCount(void)
 {
-    return rfidscan_cached_count;
+    int count;
+    rfidscan_rdlock();
+    count = rfidscan_cached_count;
+    rfidscan_rdunlock();
+    return count;
 }
 
+// the returned strings stay valid until the next rfidscan_enumerate(),
+// the index until the cache changes (enumeration or hotplug event)
 //
 const char* rfidscan_getCachedPath(int i)
 {
-    if( i > rfidscan_getCachedCount()-1 ) return NULL;
-    return rfidscan_infos[i].path;
+    const char* path = NULL;
+    rfidscan_rdlock();
+    if( i >= 0 && i < rfidscan_cached_count ) path = rfidscan_infos[i]->path;
+    rfidscan_rdunlock();
+    return path;
 }
 //
 const char* rfidscan_getCachedSerial(int i)
 {
-    if( i > rfidscan_getCachedCount()-1 ) return NULL;
-    return rfidscan_infos[i].serial;
+    const char* serial = NULL;
+    rfidscan_rdlock();
+    if( i >= 0 && i < rfidscan_cached_count ) serial = rfidscan_infos[i]->serial;
+    rfidscan_rdunlock();
+    return serial;
 }
 
 int rfidscan_getCachedVid(int i)
 {
-    if( i > rfidscan_getCachedCount()-1 ) return 0;
-    return rfidscan_infos[i].vid;
+    int vid = 0;
+    rfidscan_rdlock();
+    if( i >= 0 && i < rfidscan_cached_count ) vid = rfidscan_infos[i]->vid;
+    rfidscan_rdunlock();
+    return vid;
 }
 
 int rfidscan_getCachedPid(int i)
 {
-    if( i > rfidscan_getCachedCount()-1 ) return 0;
-    return rfidscan_infos[i].pid;
+    int pid = 0;
+    rfidscan_rdlock();
+    if( i >= 0 && i < rfidscan_cached_count ) pid = rfidscan_infos[i]->pid;
+    rfidscan_rdunlock();
+    return pid;
 }
 
 int rfidscan_getCacheIndexByPath( const char* path ) 
 {
-  int i;
-    for( i=0; i< cache_max; i++ ) { 
-        if( strcmp( rfidscan_infos[i].path, (const char*) path ) == 0 ) return i;
-    }
-    return -1;
+    int i;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byPath, rfidscan_key_path, path );
+    rfidscan_rdunlock();
+    return i;
 }
 
 int rfidscan_getCacheIndexById( uint32_t i )
@@ -144,55 +668,166 @@ int rfidscan_getCacheIndexById( uint32_t i )
 
 int rfidscan_getCacheIndexBySerial( const char* serial ) 
 {
-  int i;
-    for( i=0; i< cache_max; i++ ) { 
-        if( strcmp( rfidscan_infos[i].serial, serial ) == 0 ) return i;
-    }
-    return -1;
+    int i;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_bySerial, rfidscan_key_serial, serial );
+    rfidscan_rdunlock();
+    return i;
 }
 
 int rfidscan_getCacheIndexByDev( rfidscan_device* dev ) 
 {
-  int i;
-    for( i=0; i< cache_max; i++ ) { 
-        if( rfidscan_infos[i].dev == dev ) return i;
-    }
-    return -1;
+    int i;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    rfidscan_rdunlock();
+    return i;
 }
 
 const char* rfidscan_getSerialForDev(rfidscan_device* dev)
 {
-    int i = rfidscan_getCacheIndexByDev( dev );
-    if( i>=0 ) return rfidscan_infos[i].serial;
+    rfidscan_info* info = rfidscan_getInfo( dev );
+    if( info ) return info->serial;
     return NULL;
 }
 
+int rfidscan_setExchangeMode(rfidscan_device* dev, int mode)
+{
+    rfidscan_info* info = rfidscan_getInfo( dev );
+    if( info == NULL ) return -1;
+    info->exchange_mode = mode;
+    return 0;
+}
+
+int rfidscan_getExchangeTime(rfidscan_device* dev)
+{
+    rfidscan_info* info = rfidscan_getInfo( dev );
+    if( info == NULL ) return -1;
+    return info->exchange_ms;
+}
+
+void rfidscan_setRegisterShadow(int enable)
+{
+    int i;
+    rfidscan_wrlock();
+    rfidscan_shadow_registers = enable;
+    if( !enable ) {
+        for( i=0; i < rfidscan_cached_count; i++ ) {
+            free( rfidscan_infos[i]->shadow );
+            rfidscan_infos[i]->shadow = NULL;
+        }
+    }
+    rfidscan_wrunlock();
+}
+
+void rfidscan_invalidateRegisters(rfidscan_device* dev)
+{
+    rfidscan_shadowDrop( dev, -1 );
+}
+
+// index of the register map of pid, -1 if none
+// must be called with rfidscan_lock held
+static int rfidscan_findRegisterMap(int pid)
+{
+    int i;
+    for( i=0; i < rfidscan_register_map_count; i++ ) {
+        if( rfidscan_register_maps[i].pid == pid ) return i;
+    }
+    return -1;
+}
+
+int rfidscan_setRegisterMap(int pid, const uint8_t map[])
+{
+    int i, rc = 0;
+    rfidscan_wrlock();
+    i = rfidscan_findRegisterMap( pid );
+    if( map == NULL ) {
+        if( i >= 0 )
+            rfidscan_register_maps[i] = rfidscan_register_maps[--rfidscan_register_map_count];
+    } else {
+        if( i < 0 && rfidscan_register_map_count < rfidscan_register_maps_max )
+            i = rfidscan_register_map_count++;
+        if( i >= 0 ) {
+            rfidscan_register_maps[i].pid = pid;
+            memcpy( rfidscan_register_maps[i].map, map, rfidscan_register_map_size );
+        } else rc = -1;
+    }
+    rfidscan_wrunlock();
+    return rc;
+}
+
+int rfidscan_getRegisterMap(rfidscan_device* dev, uint8_t map[])
+{
+    int i;
+    rfidscan_rdlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i >= 0 ) {
+        // the map of the product, else the one set for any product
+        int pid = rfidscan_infos[i]->pid;
+        i = rfidscan_findRegisterMap( pid );
+        if( i < 0 ) i = rfidscan_findRegisterMap( 0 );
+        if( i >= 0 ) memcpy( map, rfidscan_register_maps[i].map, rfidscan_register_map_size );
+    }
+    rfidscan_rdunlock();
+    return ( i >= 0 ) ? 0 : -1;
+}
+
+int rfidscan_parseRegisterMap(const char *s, uint8_t map[])
+{
+    unsigned long first, last;
+    char *end;
+    int addr, count = 0;
+
+    memset( map, 0, rfidscan_register_map_size );
+    while( *s ) {
+        first = last = strtoul( s, &end, 16 );
+        if( end == s ) return -1;
+        s = end;
+        if( *s == '-' ) {
+            last = strtoul( ++s, &end, 16 );
+            if( end == s ) return -1;
+            s = end;
+        }
+        if( first > last || last > 0xFF ) return -1;
+        if( *s == ',' ) s++;
+        else if( *s ) return -1;
+
+        for( addr = (int) first; addr <= (int) last; addr++ ) {
+            if( !rfidscan_register_mapped( map, addr ) ) count++;
+            rfidscan_register_map_set( map, addr );
+        }
+    }
+    return count;
+}
+
 int rfidscan_clearCacheDev( rfidscan_device* dev ) 
 {
-    int i = rfidscan_getCacheIndexByDev( dev );
-    if( i>=0 ) rfidscan_infos[i].dev = NULL; // FIXME: hmmmm
+    int i;
+    rfidscan_wrlock();
+    i = rfidscan_lookup( &rfidscan_byDev, rfidscan_key_dev, dev );
+    if( i>=0 ) {
+        rfidscan_infos[i]->dev = NULL; // FIXME: hmmmm
+        rfidscan_infos[i]->refs = 0;
+        rfidscan_rebuildIndex( &rfidscan_byDev, rfidscan_key_dev );
+    }
+    rfidscan_wrunlock();
     return i;
 }
 
-int rfidscan_get(rfidscan_device *dev, uint8_t action, uint8_t item, uint8_t data[], size_t max_size)
+static void rfidscan_prepare_get(uint8_t buf[], uint8_t action, uint8_t item)
 {
-  uint8_t buf[rfidscan_buf_size];
-  uint8_t i;
-  int rc;
-    
-  memset(buf, 0x00, sizeof(buf));
+  memset(buf, 0x00, rfidscan_buf_size);
   buf[0] = rfidscan_report_id;
   buf[1] = 3;
   buf[2] = 0; /* Sequence number, could be incremented after each call */
   buf[3] = (uint8_t) (action & 0x7F);
   buf[4] = item;
-   
-  rc = rfidscan_exchange(dev, buf, sizeof(buf)); 
-
-  LOG("in get, exchange rc=%d\n", rc);
+}
 
-  if (rc < 0)
-    return rc;
+static int rfidscan_parse_get(uint8_t buf[], uint8_t data[], size_t max_size)
+{
+  uint8_t i;
+  int rc = 0;
 
   if (buf[2] != 0)
   {
@@ -216,6 +851,23 @@ int rfidscan_get(rfidscan_device *dev, uint8_t action, uint8_t item, uint8_t dat
   return rc;
 }
 
+int rfidscan_get(rfidscan_device *dev, uint8_t action, uint8_t item, uint8_t data[], size_t max_size)
+{
+  uint8_t buf[rfidscan_buf_size];
+  int rc;
+    
+  rfidscan_prepare_get(buf, action, item);
+   
+  rc = rfidscan_exchange(dev, buf, sizeof(buf)); 
+
+  LOG("in get, exchange rc=%d\n", rc);
+
+  if (rc < 0)
+    return rc;
+
+  return rfidscan_parse_get(buf, data, max_size);
+}
+
 int rfidscan_get_string(rfidscan_device *dev, uint8_t action, uint8_t item, char *data, size_t max_size)
 {
   int rc;
@@ -257,10 +909,18 @@ int rfidscan_set(rfidscan_device *dev, uint8_t action, uint8_t item, uint8_t dat
     buf[5+i] = data[i];
   
   rc = rfidscan_exchange(dev, buf, sizeof(buf));
-  if (rc > 0)
-      rc = 0 - buf[3];
-      
-  return rc;
+  if (rc < 0)
+    return rc;
+
+  /* the status of a SET is in byte 3 of the answer */
+  if (buf[3] != 0)
+  {
+    rc = 0 - buf[3];
+    LOG("error raised by the reader: %d\n", rc);
+    return rc;
+  }
+
+  return 0;
 }
 
 int rfidscan_Reset(rfidscan_device *dev)
@@ -269,6 +929,8 @@ int rfidscan_Reset(rfidscan_device *dev)
   
   buf[0] = SET_BEHAVIOUR_ITEM_RESET;
 
+  rfidscan_shadowDrop(dev, -1);
+
   return rfidscan_set(dev, ACTION_SET_BEHAVIOUR, 0, buf, sizeof(buf));
 }
 
@@ -278,6 +940,8 @@ int rfidscan_ApplyConfig(rfidscan_device *dev)
   
   buf[0] = SET_BEHAVIOUR_ITEM_APPLY_CONFIG;
 
+  rfidscan_shadowDrop(dev, -1);
+
   return rfidscan_set(dev, ACTION_SET_BEHAVIOUR, 0, buf, sizeof(buf));
 }
 
@@ -340,39 +1004,531 @@ int rfidscan_getVersion(rfidscan_device *dev, char *data, size_t max_size)
 
 int rfidscan_RegisterWrite(rfidscan_device *dev, uint8_t addr, uint8_t buffer[], size_t size)
 {
+  /* Not verified, read it again next time */
+  rfidscan_shadowDrop(dev, addr);
   return rfidscan_set(dev, ACTION_SET_FEED, addr, buffer, size);
 }
 
 int rfidscan_RegisterErase(rfidscan_device *dev, uint8_t addr)
 {
+  rfidscan_shadowDrop(dev, addr);
   return rfidscan_set(dev, ACTION_SET_FEED, addr, NULL, 0);
 }
 
+int rfidscan_RegisterReset(rfidscan_device *dev)
+{
+  return rfidscan_RegisterSync(dev, NULL, 0, 1, NULL, NULL);
+}
+
 int rfidscan_RegisterRead(rfidscan_device *dev, uint8_t addr, uint8_t buffer[], size_t max_size)
 {
-  return rfidscan_get(dev, ACTION_GET_FEED, addr, buffer, max_size);
+  int rc;
+
+  rc = rfidscan_shadowGet(dev, addr, buffer, max_size);
+  if (rc >= 0)
+    return rc;
+
+  rc = rfidscan_get(dev, ACTION_GET_FEED, addr, buffer, max_size);
+
+  /* Only a complete value can be shadowed */
+  if ((rc >= 0) && ((size_t) rc <= max_size))
+    rfidscan_shadowPut(dev, addr, buffer, rc);
+
+  return rc;
+}
+
+// batches do not wait the fixed delay between exchanges: switch the device
+// to polled mode for the duration of the batch, and restore it afterwards
+static int rfidscan_batchBegin(rfidscan_device *dev)
+{
+  int mode;
+  rfidscan_info *info = rfidscan_getInfo(dev);
+  if (info == NULL)
+    return rfidscan_exchange_fixed;
+  mode = info->exchange_mode;
+  info->exchange_mode = rfidscan_exchange_poll;
+  return mode;
+}
+
+static void rfidscan_batchEnd(rfidscan_device *dev, int mode)
+{
+  rfidscan_info *info = rfidscan_getInfo(dev);
+  if (info != NULL)
+    info->exchange_mode = mode;
+}
+
+// read registers in one batch, from the shadow when use_shadow is set
+// (the read-back of rfidscan_RegisterWriteMany() must not use it)
+static int rfidscan_readMany(rfidscan_device *dev, const uint8_t addrs[], int count, rfidscan_register results[], int use_shadow)
+{
+  uint8_t buf[rfidscan_buf_size];
+  int mode;
+  int k, seq, rc;
+
+  if ((dev == NULL) || (addrs == NULL) || (results == NULL) || (count < 0))
+    return -1;
+
+  mode = rfidscan_batchBegin(dev);
+
+  for (k=0; k<count; k++)
+  {
+    results[k].addr = addrs[k];
+    results[k].size = 0;
+
+    if (use_shadow)
+    {
+      rc = rfidscan_shadowGet(dev, addrs[k], results[k].data, sizeof(results[k].data));
+      if (rc >= 0)
+      {
+        results[k].size = rc;
+        continue;
+      }
+    }
+
+    rfidscan_prepare_get(buf, ACTION_GET_FEED, addrs[k]);
+
+    seq = rfidscan_exchangeSubmit(dev, buf, sizeof(buf));
+    if (seq < 0)
+      break;
+    rc = rfidscan_exchangeComplete(dev, seq, buf, sizeof(buf));
+    if (rc < 0)
+      break;
+
+    results[k].size = rfidscan_parse_get(buf, results[k].data, sizeof(results[k].data));
+    if (results[k].size <= rfidscan_register_max)
+      rfidscan_shadowPut(dev, addrs[k], results[k].data, results[k].size);
+  }
+
+  rfidscan_batchEnd(dev, mode);
+
+  LOG("rfidscan_RegisterReadMany: %d/%d registers read\n", k, count);
+  if (k < count)
+    return -1;
+
+  return count;
+}
+
+int rfidscan_RegisterReadMany(rfidscan_device *dev, const uint8_t addrs[], int count, rfidscan_register results[])
+{
+  return rfidscan_readMany(dev, addrs, count, results, 1);
+}
+
+int rfidscan_RegisterReadRange(rfidscan_device *dev, uint8_t first, uint8_t last, rfidscan_register results[])
+{
+  uint8_t addrs[256];
+  int count = 0;
+  int addr;
+
+  for (addr=first; addr<=last; addr++)
+    addrs[count++] = (uint8_t) addr;
+
+  return rfidscan_RegisterReadMany(dev, addrs, count, results);
+}
+
+// read the registers of a map, from the shadow when use_shadow is set
+static int rfidscan_readMap(rfidscan_device *dev, const uint8_t map[], rfidscan_register results[], int use_shadow)
+{
+  uint8_t addrs[256];
+  int count = 0;
+  int addr;
+
+  if (map == NULL)
+    return -1;
+
+  /* 00 and FF are not register addresses */
+  for (addr=0x01; addr<=0xFE; addr++)
+  {
+    if (rfidscan_register_mapped(map, addr))
+      addrs[count++] = (uint8_t) addr;
+  }
+
+  return rfidscan_readMany(dev, addrs, count, results, use_shadow);
+}
+
+int rfidscan_RegisterReadMap(rfidscan_device *dev, const uint8_t map[], rfidscan_register results[])
+{
+  return rfidscan_readMap(dev, map, results, 1);
+}
+
+int rfidscan_RegisterWriteMany(rfidscan_device *dev, const rfidscan_register regs[], int count, rfidscan_register readback[], int apply)
+{
+  rfidscan_register *got;
+  uint8_t addrs[256];
+  int todo[256];
+  int todo_count, failed;
+  int mode, retry, k, rc = 0;
+
+  if ((dev == NULL) || (regs == NULL) || (count < 0) || (count > 256))
+    return -1;
+
+  got = malloc((count ? count : 1) * sizeof(rfidscan_register));
+  if (got == NULL)
+    return -1;
+
+  for (k=0; k<count; k++)
+    todo[k] = k;
+  todo_count = count;
+
+  mode = rfidscan_batchBegin(dev);
+
+  for (retry=rfidscan_write_retries; (retry>=0) && (todo_count>0); retry--)
+  {
+    /* Stream all the writes that are still to be done... */
+    for (k=0; k<todo_count; k++)
+    {
+      const rfidscan_register *reg = &regs[todo[k]];
+      rc = rfidscan_RegisterWrite(dev, reg->addr, (uint8_t *) reg->data, reg->size);
+      if (rc < 0)
+        goto done;
+    }
+
+    /* ...then verify them with one batched read-back */
+    for (k=0; k<todo_count; k++)
+      addrs[k] = regs[todo[k]].addr;
+    rc = rfidscan_readMany(dev, addrs, todo_count, got, 0);
+    if (rc < 0)
+      goto done;
+
+    /* Keep only the registers that did not read back as written */
+    failed = 0;
+    for (k=0; k<todo_count; k++)
+    {
+      const rfidscan_register *reg = &regs[todo[k]];
+
+      if (readback != NULL)
+        readback[todo[k]] = got[k];
+
+      if ((got[k].size == reg->size) && ((reg->size == 0) || !memcmp(got[k].data, reg->data, reg->size)))
+        continue;
+
+      LOG("rfidscan_RegisterWriteMany: %02X mismatch, %d retries left\n", reg->addr, retry);
+      todo[failed++] = todo[k];
+    }
+    todo_count = failed;
+  }
+
+  rc = todo_count;
+
+  if ((rc == 0) && apply)
+    rc = rfidscan_ApplyConfig(dev);
+
+done:
+  rfidscan_batchEnd(dev, mode);
+  free(got);
+  return rc;
+}
+
+uint64_t rfidscan_fingerprintRegisters(const rfidscan_register regs[], int count)
+{
+  const rfidscan_register *by_addr[256];
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  const rfidscan_register *reg;
+  int addr, k;
+
+  memset(by_addr, 0, sizeof(by_addr));
+  for (k=0; k<count; k++)
+    by_addr[regs[k].addr] = &regs[k];
+
+  for (addr=0; addr<256; addr++)
+  {
+    reg = by_addr[addr];
+    if ((reg == NULL) || (reg->size <= 0) || (reg->size > rfidscan_register_max))
+      continue;
+
+    hash = (hash ^ (uint8_t) addr) * 0x100000001B3ULL;
+    hash = (hash ^ (uint8_t) reg->size) * 0x100000001B3ULL;
+    for (k=0; k<reg->size; k++)
+      hash = (hash ^ reg->data[k]) * 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+int rfidscan_RegisterFingerprint(rfidscan_device *dev, const uint8_t map[], uint64_t *fingerprint, rfidscan_register results[])
+{
+  rfidscan_register regs[254];
+  int rc;
+
+  if (fingerprint == NULL)
+    return -1;
+
+  if (results == NULL)
+    results = regs;
+
+  /* what is compared is the device, not what the shadow remembers of it */
+  rc = rfidscan_readMap(dev, map, results, 0);
+  if (rc < 0)
+    return rc;
+
+  *fingerprint = rfidscan_fingerprintRegisters(results, rc);
+  return rc;
+}
+
+int rfidscan_RegisterSync(rfidscan_device *dev, const rfidscan_register target[], int count, int erase, rfidscan_register changed[], int *written)
+{
+  rfidscan_register *current, *todo;
+  uint8_t map[rfidscan_register_map_size];
+  uint8_t addrs[256];
+  int wanted[256];
+  int n = 0, todo_count = 0;
+  int has_map;
+  int addr, k, rc;
+
+  if (written != NULL)
+    *written = 0;
+
+  if ((dev == NULL) || ((target == NULL) && (count > 0)) || (count < 0) || (count > 254))
+    return -1;
+
+  /* wanted[addr] is the index of addr in target, plus 1. 00 and FF are not
+     register addresses, and each register has one value */
+  memset(wanted, 0, sizeof(wanted));
+  for (k=0; k<count; k++)
+  {
+    if ((target[k].addr == 0x00) || (target[k].addr == 0xFF) ||
+        (target[k].size < 0) || (target[k].size > rfidscan_register_max) ||
+        wanted[target[k].addr])
+    {
+      LOG("rfidscan_RegisterSync: invalid target entry %d\n", k);
+      return -1;
+    }
+    wanted[target[k].addr] = k + 1;
+  }
+
+  /* Only the registers of target are compared, unless the others are erased:
+     then all the ones the product can hold */
+  has_map = erase && (rfidscan_getRegisterMap(dev, map) == 0);
+  for (addr=0x01; addr<=0xFE; addr++)
+  {
+    if (wanted[addr] || (erase && (!has_map || rfidscan_register_mapped(map, addr))))
+      addrs[n++] = (uint8_t) addr;
+  }
+
+  current = malloc((n ? n : 1) * sizeof(rfidscan_register));
+  todo = malloc((n ? n : 1) * sizeof(rfidscan_register));
+  if ((current == NULL) || (todo == NULL))
+  {
+    free(current);
+    free(todo);
+    return -1;
+  }
+
+  /* from the device: a stale shadow would hide registers to write */
+  rc = rfidscan_readMany(dev, addrs, n, current, 0);
+  if (rc < 0)
+    goto done;
+
+  for (k=0; k<n; k++)
+  {
+    if (wanted[addrs[k]])
+    {
+      const rfidscan_register *reg = &target[wanted[addrs[k]] - 1];
+
+      if ((current[k].size == reg->size) && ((reg->size == 0) || !memcmp(current[k].data, reg->data, reg->size)))
+        continue;
+      todo[todo_count++] = *reg;
+    } else
+    {
+      /* Already empty, or not a register this device can read back */
+      if (current[k].size <= 0)
+        continue;
+      todo[todo_count].addr = addrs[k];
+      todo[todo_count].size = 0;
+      todo_count++;
+    }
+  }
+
+  LOG("rfidscan_RegisterSync: %d/%d registers to write\n", todo_count, n);
+
+  rc = 0;
+  if (todo_count > 0)
+    rc = rfidscan_RegisterWriteMany(dev, todo, todo_count, changed, 0);
+  if ((rc >= 0) && (written != NULL))
+    *written = todo_count;
+
+done:
+  free(current);
+  free(todo);
+  return rc;
+}
+
+
+// --------------------------------------------------------------------------- 
+// Schema of the FEED registers
+
+const rfidscan_symbol rfidscan_layouts[] = {
+  { "qwerty",         0x00 },
+  { "azerty-desktop", 0x01 },
+  { "azerty-full",    0x01 },
+  { "qwertz",         0x02 },
+  { "azerty",         0x03 },
+  { "azerty-laptop",  0x03 },
+  { NULL,             0 }
+};
+
+const rfidscan_symbol rfidscan_led_modes[] = {
+  { "off",      0 },  { "0",  0 },
+  { "on",       1 },  { "1",  1 },
+  { "slow",     2 },  { "s",  2 },
+  { "auto",     3 },  { "a",  3 },
+  { "fast",     4 },  { "f",  4 },
+  { "heart",    5 },  { "h",  5 },
+  { "slowinv",  6 },  { "si", 6 },
+  { "fastinv",  7 },  { "fi", 7 },
+  { "heartinv", 8 },  { "hi", 8 },
+  { "half",     9 },  { "2",  9 },
+  { "halfinv",  10 }, { "2i", 10 },
+  { "type",     11 }, { "t",  11 },
+  { "field",    12 }, { "rf", 12 },
+  { "default",  13 }, { "d",  13 },
+  { "float",    14 }, { "fl", 14 },
+  { "ignore",   15 }, { "_",  15 },
+  { NULL,       0 }
+};
+
+// in address order
+static const rfidscan_register_schema rfidscan_schema[] = {
+  { 0x55,                  "secret-55", rfidscan_type_bytes, 1, rfidscan_register_max, rfidscan_schema_secret, NULL },
+  { 0x56,                  "secret-56", rfidscan_type_bytes, 1, rfidscan_register_max, rfidscan_schema_secret, NULL },
+  { rfidscan_reg_password, "password",  rfidscan_type_bytes, 2, 2,                     rfidscan_schema_secret, NULL },
+  { rfidscan_reg_layout,   "layout",    rfidscan_type_enum,  1, 1,                     0,                      rfidscan_layouts },
+};
+
+const rfidscan_register_schema* rfidscan_registerSchema(uint8_t addr)
+{
+  int i;
+
+  for (i=0; i<(int) (sizeof(rfidscan_schema)/sizeof(rfidscan_schema[0])); i++)
+  {
+    if (rfidscan_schema[i].addr == addr)
+      return &rfidscan_schema[i];
+  }
+
+  return NULL;
+}
+
+int rfidscan_checkRegister(const rfidscan_register *reg)
+{
+  const rfidscan_register_schema *schema;
+
+  if ((reg == NULL) || (reg->size < 0) || (reg->size > rfidscan_register_max))
+    return -1;
+
+  schema = rfidscan_registerSchema(reg->addr);
+  if ((schema == NULL) || (reg->size == 0))
+    return 0;
+
+  if ((reg->size < schema->min_size) || (reg->size > schema->max_size))
+    return -1;
+
+  if ((schema->type == rfidscan_type_enum) && (rfidscan_decodeSymbol(schema->symbols, reg->data[0]) == NULL))
+    return -1;
+
+  return 0;
+}
+
+int rfidscan_encodeSymbol(const rfidscan_symbol symbols[], const char *name)
+{
+  const char *a, *b;
+  int i;
+
+  for (i=0; (symbols != NULL) && (symbols[i].name != NULL); i++)
+  {
+    /* Not stricmp(), which has another name on each platform */
+    for (a=symbols[i].name, b=name; (*a != '\0') && (toupper((uint8_t) *a) == toupper((uint8_t) *b)); a++, b++)
+      ;
+    if ((*a == '\0') && (*b == '\0'))
+      return symbols[i].value;
+  }
+
+  return -1;
+}
+
+const char* rfidscan_decodeSymbol(const rfidscan_symbol symbols[], uint8_t value)
+{
+  int i;
+
+  for (i=0; (symbols != NULL) && (symbols[i].name != NULL); i++)
+  {
+    if (symbols[i].value == value)
+      return symbols[i].name;
+  }
+
+  return NULL;
+}
+
+int rfidscan_encodeRegister(uint8_t addr, const char *name, rfidscan_register *reg)
+{
+  const rfidscan_register_schema *schema = rfidscan_registerSchema(addr);
+  int value;
+
+  if ((schema == NULL) || (schema->type != rfidscan_type_enum) || (reg == NULL))
+    return -1;
+
+  value = rfidscan_encodeSymbol(schema->symbols, name);
+  if (value < 0)
+    return -1;
+
+  reg->addr = addr;
+  reg->size = 1;
+  reg->data[0] = (uint8_t) value;
+  return 0;
+}
+
+int rfidscan_decodeRegister(const rfidscan_register *reg, char *text, size_t size)
+{
+  const rfidscan_register_schema *schema;
+  const char *name = NULL;
+  size_t len = 0;
+  int i;
+
+  if ((reg == NULL) || (reg->size < 0) || (reg->size > rfidscan_register_max) || (size == 0))
+    return -1;
+
+  schema = rfidscan_registerSchema(reg->addr);
+  if ((schema != NULL) && (schema->type == rfidscan_type_enum) && (reg->size == 1))
+    name = rfidscan_decodeSymbol(schema->symbols, reg->data[0]);
+
+  if (2 * (size_t) reg->size + (name ? strlen(name) + 3 : 0) >= size)
+    return -1;
+
+  for (i=0; i<reg->size; i++)
+  {
+    if ((schema != NULL) && (schema->flags & rfidscan_schema_secret))
+      len += sprintf(&text[len], "XX");
+    else
+      len += sprintf(&text[len], "%02X", reg->data[i]);
+  }
+  if (name != NULL)
+    len += sprintf(&text[len], " (%s)", name);
+  text[len] = '\0';
+
+  return (int) len;
 }
 
 
 // qsort char* string comparison function 
 int cmp_rfidscan_info_serial(const void *a, const void *b) 
 { 
-    rfidscan_info* bia = (rfidscan_info*) a;
-    rfidscan_info* bib = (rfidscan_info*) b;
+    rfidscan_info* bia = *(rfidscan_info**) a;
+    rfidscan_info* bib = *(rfidscan_info**) b;
 
     return strncmp( bia->serial, 
                     bib->serial, 
                     serialstrmax);
 } 
 
+// must be called with rfidscan_lock held for writing
 void rfidscan_sortCache(void)
 {
-    size_t elemsize = sizeof( rfidscan_info ); //  
+    size_t elemsize = sizeof( rfidscan_info* ); //  
     
     qsort( rfidscan_infos, 
            rfidscan_cached_count, 
            elemsize, 
            cmp_rfidscan_info_serial);
+
+    rfidscan_reindex();
 }
 
 
@@ -386,4 +1542,16 @@ void rfidscan_sleep(uint16_t millis)
 #endif
 }
 
+// simple cross-platform monotonic millis counter, used to time exchanges
+static uint32_t rfidscan_millis(void)
+{
+#ifdef WIN32
+    return GetTickCount();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
+}
+
 
@@ -18,9 +18,9 @@
 extern "C" {
 #endif
 
-#define rfidscan_max_devices 16
+#define rfidscan_max_devices 256  /**< ids above this are serial numbers */
 
-#define cache_max 16  
+#define cache_max 16  /**< initial size of the device cache, grows as needed */
 #define serialstrmax (8 + 1) 
 #define pathstrmax 128
 
@@ -28,6 +28,28 @@ extern "C" {
 #define rfidscan_report_size 64
 #define rfidscan_buf_size (rfidscan_report_size+1)
 
+#define rfidscan_register_max 60  /**< max size of a FEED register value */
+#define rfidscan_write_retries 3  /**< extra write passes of rfidscan_RegisterWriteMany() */
+#define rfidscan_register_map_size 32  /**< bytes of a register map, one bit per address */
+
+/** test and set the bit of addr in a register map */
+#define rfidscan_register_mapped(map, addr) (((map)[(addr) >> 3] >> ((addr) & 7)) & 1)
+#define rfidscan_register_map_set(map, addr) ((map)[(addr) >> 3] |= (uint8_t) (1 << ((addr) & 7)))
+
+#define rfidscan_exchange_fixed 0  /**< wait a fixed delay before reading the answer */
+#define rfidscan_exchange_poll  1  /**< poll the answer with a growing backoff */
+
+#define rfidscan_reg_password 0x6F  /**< 2 bytes, FFFF once the reader is locked */
+#define rfidscan_reg_layout   0xA0  /**< keyboard layout, one of rfidscan_layouts */
+
+#define rfidscan_type_bytes 0  /**< any value */
+#define rfidscan_type_enum  1  /**< one byte, one of the symbols of the register */
+
+#define rfidscan_schema_secret 0x01  /**< the value is never shown */
+
+#define rfidscan_hotplug_arrived 1  /**< device plugged in, added to the cache */
+#define rfidscan_hotplug_left    2  /**< device unplugged, dropped from the cache */
+
 struct rfidscan_device_;
 
 #if USE_HIDAPI
@@ -38,6 +60,46 @@ typedef struct usbDevice   rfidscan_device; /**< opaque rfidscan structure */
 typedef struct hid_device_ rfidscan_device; /**< opaque rfidscan structure */
 #endif
 
+/** completion callback of rfidscan_exchangeAsync(), rc as for rfidscan_exchange(),
+ *  dev is NULL if the device was closed before the exchange completed */
+typedef void (*rfidscan_exchange_cb)(rfidscan_device* dev, int rc, uint8_t *buf, void *user_data);
+
+/** input callback of rfidscan_watchInput(), len is -1 once the device is gone */
+typedef void (*rfidscan_input_cb)(rfidscan_device* dev, const uint8_t *data, int len, void *user_data);
+
+/** hotplug callback of rfidscan_hotplugRegister(), with the serial of the device */
+typedef void (*rfidscan_hotplug_cb)(int event, const char* serial, void *user_data);
+
+/** value of a FEED register, as returned by rfidscan_RegisterReadMany() */
+typedef struct rfidscan_register_ {
+    uint8_t addr;   /**< register address */
+    int size;       /**< size of the value, 0 if empty, <0 if refused by the device */
+    uint8_t data[rfidscan_register_max];
+} rfidscan_register;
+
+/** name of a value, tables of symbols end with a NULL name */
+typedef struct rfidscan_symbol_ {
+    const char *name;
+    uint8_t value;
+} rfidscan_symbol;
+
+/** what a FEED register holds, see rfidscan_registerSchema() */
+typedef struct rfidscan_register_schema_ {
+    uint8_t addr;
+    const char *name;
+    int type;           /**< rfidscan_type_bytes or rfidscan_type_enum */
+    uint8_t min_size;   /**< of a value, an empty register is always valid */
+    uint8_t max_size;
+    int flags;          /**< rfidscan_schema_secret */
+    const rfidscan_symbol *symbols;  /**< values of a rfidscan_type_enum register */
+} rfidscan_register_schema;
+
+/** values of rfidscan_reg_layout, e.g. "azerty" */
+extern const rfidscan_symbol rfidscan_layouts[];
+
+/** modes of each LED of rfidscan_setLedsP() and rfidscan_setLedsT(), e.g. "slow" */
+extern const rfidscan_symbol rfidscan_led_modes[];
+
 
 //
 // -------- BEGIN PUBLIC API ----------
@@ -57,6 +119,33 @@ int          rfidscan_enumerate();
  */
 int          rfidscan_enumerateByVidPid(int vid, int pid);
 
+/**
+ * Scan USB for devices by given VID and any of several PIDs.
+ * The bus is walked only once, whatever the number of PIDs.
+ * @param vid vendor ID
+ * @param pids table of product IDs
+ * @param pid_count number of entries in pids
+ * @return number of devices found
+ */
+int          rfidscan_enumerateByVidPids(int vid, const int pids[], int pid_count);
+
+/**
+ * Keep the device cache up to date as devices are plugged in and unplugged,
+ * instead of calling rfidscan_enumerate() again. The events are handled by
+ * rfidscan_handleEvents(), which then calls callback once the cache has been
+ * updated. Call rfidscan_enumerate() first to fill the cache.
+ * Only supported by the libusb and Linux/hidraw backends.
+ * @param callback called for every arrival and departure, may be NULL
+ * @param user_data passed to callback
+ * @return 0 on success, -1 on error
+ */
+int          rfidscan_hotplugRegister(rfidscan_hotplug_cb callback, void *user_data);
+
+/**
+ * Stop the updates set up by rfidscan_hotplugRegister().
+ */
+void         rfidscan_hotplugDeregister(void);
+
 /**
  * Open first found blink(1) device.
  * @return pointer to opened rfidscan_device or NULL if no rfidscan found
@@ -81,24 +170,237 @@ rfidscan_device* rfidscan_openBySerial(const char* serial);
 /**
  * Open by "id", which if from 0-rfidscan_max_devices is index
  *  or if >rfidscan_max_devices, is numerical representation of serial number
- * @param id ordinal 0-15 id of rfidscan or numerical rep of 8-hex digit serial
+ * @param id ordinal id of rfidscan or numerical rep of 8-hex digit serial
  * @return rfidscan_device or NULL if no rfidscan found
  */
 rfidscan_device* rfidscan_openById( uint32_t id );
 
 /**
  * Close opened rfidscan device.  
- * Safe to call rfidscan_close on already closed device.
+ * Opening a device already opened returns the same handle, with one more
+ * reference: it is only really closed once every rfidscan_open*() call
+ * has been matched by a rfidscan_close().
  * @param dev rfidscan_device
  */
 void rfidscan_close( rfidscan_device* dev );
 
+/**
+ * Keep the devices open once their last user has closed them, so that
+ * opening them again is immediate. The handles are released by
+ * rfidscan_closeIdle(), or when the device is no longer enumerated.
+ * @param keep 1 to keep handles open, 0 to close them (closes idle handles now)
+ */
+void rfidscan_setKeepOpen(int keep);
+
+/**
+ * Close the handles kept open by rfidscan_setKeepOpen() that nobody uses.
+ */
+void rfidscan_closeIdle(void);
+
+/**
+ * Keep a shadow of the FEED registers of each device, so that reading a
+ * register again is served from memory. A register is shadowed when read,
+ * updated when rfidscan_RegisterWriteMany() reads it back, and forgotten
+ * when written otherwise. The whole shadow of a device is forgotten by
+ * rfidscan_ApplyConfig(), rfidscan_Reset(), and when it is opened again
+ * or plugged in again. Off by default.
+ * @param enable 1 to shadow the registers, 0 to read them from the device
+ */
+void rfidscan_setRegisterShadow(int enable);
+
+/**
+ * Forget the shadowed registers of a device, e.g. after another process
+ * has written them.
+ * @param dev opened rfidscan device
+ */
+void rfidscan_invalidateRegisters(rfidscan_device* dev);
+
+/**
+ * Set the map of the FEED registers a product can hold, so that
+ * rfidscan_RegisterReadMap() reads only them.
+ * @param pid product ID, 0 for the products without a map of their own
+ * @param map rfidscan_register_map_size bytes, NULL to forget the map of pid
+ * @return 0 on success, -1 if too many maps are set
+ */
+int rfidscan_setRegisterMap(int pid, const uint8_t map[]);
+
+/**
+ * Get the map of the FEED registers a device can hold.
+ * @param dev opened rfidscan device
+ * @param map receives rfidscan_register_map_size bytes
+ * @return 0 on success, -1 if no map is set for the product of dev
+ */
+int rfidscan_getRegisterMap(rfidscan_device* dev, uint8_t map[]);
+
+/**
+ * Parse a register map written as a list of hex addresses and ranges,
+ * e.g. "10-1F,6F,A0".
+ * @param map receives rfidscan_register_map_size bytes
+ * @return number of addresses in the map, or -1 if s is not valid
+ */
+int rfidscan_parseRegisterMap(const char *s, uint8_t map[]);
+
+/**
+ * Get what a FEED register holds.
+ * @param addr register address
+ * @return the schema of the register, NULL if rfidscan-lib does not know it
+ */
+const rfidscan_register_schema* rfidscan_registerSchema(uint8_t addr);
+
+/**
+ * Check a register value against its schema, before writing it.
+ * @return 0 if valid or not in the schema, -1 otherwise
+ */
+int rfidscan_checkRegister(const rfidscan_register *reg);
+
+/**
+ * Value of a symbol, the case of name being ignored.
+ * @return the value, or -1 if name is not in symbols
+ */
+int rfidscan_encodeSymbol(const rfidscan_symbol symbols[], const char *name);
+
+/**
+ * Name of a value, the first one when it has several.
+ * @return the name, or NULL if value is not in symbols
+ */
+const char* rfidscan_decodeSymbol(const rfidscan_symbol symbols[], uint8_t value);
+
+/**
+ * Value of a rfidscan_type_enum register given by the name of a symbol,
+ * e.g. "azerty" for rfidscan_reg_layout.
+ * @param reg receives the register
+ * @return 0 on success, -1 if the register has no such symbol
+ */
+int rfidscan_encodeRegister(uint8_t addr, const char *name, rfidscan_register *reg);
+
+/**
+ * Text of a register value, as shown by the dumps: the bytes in hex, XX
+ * for each byte of a secret, followed by the name of the symbol if any,
+ * e.g. "03 (azerty)".
+ * @param text receives the text, "" for an empty register
+ * @return length of the text, or -1 if size is too small
+ */
+int rfidscan_decodeRegister(const rfidscan_register *reg, char *text, size_t size);
+
+/**
+ * Select the hidapi backend, when several are built in (Linux: "libusb",
+ * the default, or "hidraw" which leaves the RFID Scanners to the usbhid
+ * driver). The RFIDSCAN_BACKEND environment variable sets the default.
+ * Call it before opening any device: the cache is emptied.
+ * @param name name of the backend
+ * @return 0 on success, -1 if unknown or devices are still open
+ */
+int rfidscan_setBackend(const char* name);
+
+/**
+ * Name of the hidapi backend in use.
+ */
+const char* rfidscan_getBackend(void);
+
 /**
  * Low-level communication with rfidscan device.
  * Used internally by rfidscan-lib
  */
 int rfidscan_exchange(rfidscan_device* dev, uint8_t *buf, int len);
 
+/**
+ * Send a command to rfidscan device without waiting for its answer.
+ * The command gets a per-device sequence number, kept on the host side only:
+ * the firmware does not echo it, so buf is sent unchanged.
+ * Only one command may be pending per device (the answer lives in the
+ * single feature report of the device), but commands may be pending on
+ * several devices at once.
+ * @param dev opened rfidscan device
+ * @param buf command frame
+ * @param len length of the command frame
+ * @return sequence number of the command (0 if dev is not in cache), or -1 on error
+ */
+int rfidscan_exchangeSubmit(rfidscan_device* dev, uint8_t *buf, int len);
+
+/**
+ * Wait for the answer to a command sent by rfidscan_exchangeSubmit().
+ * Frames that are empty or still hold the command are polled again.
+ * @param dev opened rfidscan device
+ * @param seq sequence number returned by rfidscan_exchangeSubmit()
+ * @param buf buffer to receive the answer
+ * @param len size of buf
+ * @return number of bytes read, or -1 on error or timeout
+ */
+int rfidscan_exchangeComplete(rfidscan_device* dev, int seq, uint8_t *buf, int len);
+
+/**
+ * Exchange a command with rfidscan device without blocking.
+ * The command is sent and its answer polled with asynchronous transfers,
+ * callback is called from rfidscan_handleEvents() once the answer is there.
+ * buf must stay valid until then. Only one exchange may be pending per device.
+ * Only supported by the libusb backend.
+ * @param dev opened rfidscan device, in cache
+ * @param buf command frame, receives the answer
+ * @param len size of buf
+ * @param callback called with the result of the exchange
+ * @param user_data passed to callback
+ * @return sequence number of the command, or -1 on error
+ */
+int rfidscan_exchangeAsync(rfidscan_device* dev, uint8_t *buf, int len, rfidscan_exchange_cb callback, void *user_data);
+
+/**
+ * Call the callbacks of the asynchronous exchanges that progressed,
+ * apply the hotplug events received, and pass the input reports of the
+ * devices watched by rfidscan_watchInput() to their callbacks.
+ * On Linux a single epoll set covers all of them, so one thread serves
+ * any number of devices.
+ * @param milliseconds time to wait for progress, -1 to block, 0 to return immediately
+ * @return number of transfers and reports handled, or -1 on error
+ */
+int rfidscan_handleEvents(int milliseconds);
+
+/**
+ * Time until rfidscan_handleEvents() has to poll again an exchange still waiting
+ * for its answer, for callers that wait on rfidscan_getEventFd() themselves.
+ * @return milliseconds, or -1 if no exchange is waiting
+ */
+int rfidscan_getEventTimeout(void);
+
+/**
+ * File descriptor that becomes readable when rfidscan_handleEvents() has work to do.
+ * @return file descriptor, or -1 if asynchronous exchanges are not supported
+ */
+int rfidscan_getEventFd(void);
+
+/**
+ * Pass the input reports of an opened device to callback, from
+ * rfidscan_handleEvents(). Only supported on Linux by the hidraw backend,
+ * which has a file descriptor per device. Closing the device stops it.
+ * @param dev opened rfidscan device, in cache
+ * @param callback called for each input report
+ * @param user_data passed to callback
+ * @return 0 on success, -1 on error or if not supported
+ */
+int rfidscan_watchInput(rfidscan_device* dev, rfidscan_input_cb callback, void *user_data);
+
+/**
+ * Stop passing the input reports of a device to its callback.
+ * @param dev rfidscan device given to rfidscan_watchInput()
+ */
+void rfidscan_unwatchInput(rfidscan_device* dev);
+
+/**
+ * Select how rfidscan_exchange() waits for the answer of the device.
+ * rfidscan_exchange_fixed (the default) sleeps 120ms before reading it,
+ * rfidscan_exchange_poll reads it as soon as the device has produced it.
+ * @param dev opened rfidscan device
+ * @param mode rfidscan_exchange_fixed or rfidscan_exchange_poll
+ * @return 0 on success, -1 if dev is not in cache
+ */
+int rfidscan_setExchangeMode(rfidscan_device* dev, int mode);
+
+/**
+ * Time the device took to answer the last exchange.
+ * @param dev opened rfidscan device
+ * @return time in milliseconds, or -1 if unknown
+ */
+int rfidscan_getExchangeTime(rfidscan_device* dev);
+
 int rfidscan_getVendorName(rfidscan_device *dev, char *data, size_t max_size);
 int rfidscan_getProductName(rfidscan_device *dev, char *data, size_t max_size);
 int rfidscan_getSerialNumber(rfidscan_device *dev, char *data, size_t max_size);
@@ -119,13 +421,112 @@ int rfidscan_setLedsT(rfidscan_device *dev, uint8_t r, uint8_t g, uint8_t b, uin
  */
 int rfidscan_RegisterRead(rfidscan_device *dev, uint8_t addr, uint8_t *data, size_t max_size);
 
+/**
+ * Read a list of registers from FEED in one call.
+ * The exchanges are chained without the fixed delay of rfidscan_exchange_fixed.
+ * @param dev opened rfidscan device
+ * @param addrs addresses of the registers to read
+ * @param count number of addresses
+ * @param results table of count entries, filled in the order of addrs
+ * @return count on success, or -1 if the communication failed
+ */
+int rfidscan_RegisterReadMany(rfidscan_device *dev, const uint8_t addrs[], int count, rfidscan_register results[]);
+
+/**
+ * Read all registers from first to last (included) from FEED in one call.
+ * @param results table of (last-first+1) entries
+ * @return number of entries filled, or -1 if the communication failed
+ */
+int rfidscan_RegisterReadRange(rfidscan_device *dev, uint8_t first, uint8_t last, rfidscan_register results[]);
+
+/**
+ * Read the registers of a map (see rfidscan_getRegisterMap()) from FEED
+ * in one call, skipping the addresses that can not hold data.
+ * @param results table of 254 entries max, filled in the order of the addresses
+ * @return number of entries filled, or -1 if the communication failed
+ */
+int rfidscan_RegisterReadMap(rfidscan_device *dev, const uint8_t map[], rfidscan_register results[]);
+
 /** 
  * Write register into FEED
  */
 int rfidscan_RegisterWrite(rfidscan_device *dev, uint8_t addr, uint8_t buffer[], size_t size);
 
+/**
+ * Erase register from FEED
+ */
+int rfidscan_RegisterErase(rfidscan_device *dev, uint8_t addr);
 
+/**
+ * Write a list of registers into FEED as one transaction.
+ * All the writes are streamed, then verified with one batched read-back;
+ * only the registers that did not read back as written are written again
+ * (up to rfidscan_write_retries times).
+ * @param dev opened rfidscan device
+ * @param regs registers to write, a size of 0 erases the register
+ * @param count number of registers (max 256)
+ * @param readback optional table of count entries, receives the values read back
+ * @param apply if non-zero, call rfidscan_ApplyConfig() once everything is verified
+ * @return 0 on success, number of registers that could not be verified,
+ *         or <0 if the communication failed
+ */
+int rfidscan_RegisterWriteMany(rfidscan_device *dev, const rfidscan_register regs[], int count, rfidscan_register readback[], int apply);
+
+/**
+ * Bring FEED to the values of target, writing only what differs.
+ * The registers concerned are read from the device (never from the register
+ * shadow) once in a batch and compared to target;
+ * the ones that differ are written with rfidscan_RegisterWriteMany().
+ * @param dev opened rfidscan device
+ * @param target registers wanted, one entry per address 01..FE, a size of
+ *        0 (empty) to rfidscan_register_max
+ * @param count number of entries of target (max 254)
+ * @param erase if non-zero, the registers 01..FE not in target must be empty
+ *        (only the ones of the register map of dev, when it has one)
+ * @param changed optional table of 254 entries, receives the registers written,
+ *        as read back
+ * @param written optional, receives the number of registers written
+ * @return 0 on success, number of registers that could not be verified,
+ *         or <0 if target is invalid or the communication failed
+ */
+int rfidscan_RegisterSync(rfidscan_device *dev, const rfidscan_register target[], int count, int erase, rfidscan_register changed[], int *written);
+
+/**
+ * Fingerprint of a set of registers: 64-bit FNV-1a of the address, size
+ * and value of the registers set, in address order. The empty registers
+ * are left out, and the order of regs does not matter.
+ * @param regs registers, a later entry replaces an earlier one at the same address
+ * @param count number of entries of regs
+ */
+uint64_t rfidscan_fingerprintRegisters(const rfidscan_register regs[], int count);
+
+/**
+ * Fingerprint of the registers of a map (see rfidscan_getRegisterMap()),
+ * read from FEED in one call (never from the register shadow), to be
+ * compared to the fingerprint of the
+ * registers expected there.
+ * @param dev opened rfidscan device
+ * @param map registers to read
+ * @param fingerprint receives the fingerprint, see rfidscan_fingerprintRegisters()
+ * @param results optional table of 254 entries, receives the registers read
+ * @return number of registers read, or -1 if the communication failed
+ */
+int rfidscan_RegisterFingerprint(rfidscan_device *dev, const uint8_t map[], uint64_t *fingerprint, rfidscan_register results[]);
+
+/**
+ * Erase all the registers of FEED. Only the registers set are erased,
+ * found with one batched read, see rfidscan_RegisterSync().
+ * @param dev opened rfidscan device
+ * @return 0 on success, number of registers that could not be verified,
+ *         or <0 if the communication failed
+ */
 int rfidscan_RegisterReset(rfidscan_device *dev);
+
+/**
+ * Restart the RFID Scanner.
+ */
+int rfidscan_Reset(rfidscan_device *dev);
+
 int rfidscan_ApplyConfig(rfidscan_device *dev);
 
 
@@ -137,12 +538,15 @@ void rfidscan_sleep(uint16_t delayMillis);
 
 /**
  * Return platform-specific USB path for given cache index.
+ * The string stays valid until the next rfidscan_enumerate(), even if the
+ * device is unplugged meanwhile.
  * @param i cache index
  * @return path string
  */
 const char*  rfidscan_getCachedPath(int i);
 /**
  * Return bilnk1 serial number for given cache index.
+ * The string stays valid until the next rfidscan_enumerate().
  * @param i cache index
  * @return 8-hexdigit serial number as string
  */
@@ -153,6 +557,8 @@ int rfidscan_getCachedPid(int i);
 
 /**
  * Return cache index for a given platform-specific USB path.
+ * Cache indexes only hold until the cache changes: rfidscan_enumerate() and
+ * hotplug events add, remove and sort the entries.
  * @param path platform-specific path string
  * @return cache index or -1 if not found
  */
@@ -184,6 +590,7 @@ int          rfidscan_clearCacheDev( rfidscan_device* dev );
 
 /**
  * Return serial number string for give rfidscan device.
+ * The string stays valid while dev is open.
  * @param dev blink device to lookup
  * @return 8-hexdigit serial number string
  */
@@ -2,35 +2,63 @@
 *
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE    // for struct ucred
+#endif
+
 #include <stdio.h>
 #include <stdarg.h>    // vararg stuff
 #include <string.h>    // for memset(), strcmp(), et al
 #include <stdlib.h>
 #include <stdint.h>
+#include <ctype.h>     // for isxdigit()
 
 #ifndef WIN32
 #include <getopt.h>    // for getopt_long()
 #include <unistd.h>
+#include <pthread.h>   // for the --jobs workers
+#include <sys/socket.h> // for --daemon
+#include <sys/un.h>
+#include <sys/stat.h>  // for mkdir()
 #define stricmp strcasecmp
+#define THREAD_LOCAL __thread
 #endif
 
 #ifdef WIN32
 #include "windows/libs/getopt.h"
 #include <Windows.h>
+#include <direct.h>    // for _mkdir()
 #define sleep(s) Sleep(1000*s)
+#define snprintf _snprintf
+#define THREAD_LOCAL __declspec(thread)
 #endif
 
 #include "rfidscan-lib.h"
+#include "rfidscand.h"
 
 int quiet = 0;
 
+// output of the device the current thread works on, stdout if NULL.
+// With --jobs every device writes to its own temporary file, copied to
+// stdout in device order once all the devices are done
+static THREAD_LOCAL FILE *out_fp = NULL;
+
+// printf to the output of the current device
+static void out(const char* fmt, ...)
+{
+  va_list args;
+  va_start(args,fmt);
+  vfprintf(out_fp ? out_fp : stdout, fmt, args);
+  va_end(args);
+}
+
 // printf that can be shut up
 void msg(char* fmt, ...)
 {
   va_list args;
   va_start(args,fmt);
   if( !quiet ) {
-    vprintf(fmt,args);
+    vfprintf(out_fp ? out_fp : stdout, fmt, args);
   }
   va_end(args);
 }
@@ -135,69 +163,70 @@ static int do_test(rfidscan_device *dev)
   return rc;
 }
 
+//
+static void show_version(const char *vendor, const char *product, const char *serial, const char *version)
+{
+  out("\tVendorName  : %s\n", vendor);
+  out("\tProductName : %s\n", product);
+  out("\tSerialNumber: %s\n", serial);
+
+  if (strlen(version) == 10)
+  {
+    out("\tVersion     : %c%c.%c%c (SpringProx LIB %c%c.%c%c, build %c%c)\n",
+      version[0] != '0' ? version[0] : 0, version[1], version[2], version[3],
+      version[4] != '0' ? version[4] : 0, version[5], version[6], version[7],
+      version[8] != '0' ? version[8] : 0, version[9]);
+  } else
+  {
+    out("\tVersion     : %s\n", version);
+  }
+}
+
 //
 static int do_get_version(rfidscan_device *dev)
 {
-  char data[64];
+  char vendor[64], product[64], serial[64], version[64];
   int rc;
 
-  rc = rfidscan_getVendorName(dev, data, sizeof(data));
+  rc = rfidscan_getVendorName(dev, vendor, sizeof(vendor));
   if (rc < 0)
     return rc;
 
-  printf("\tVendorName  : %s\n", data);
-
-  rc = rfidscan_getProductName(dev, data, sizeof(data));
+  rc = rfidscan_getProductName(dev, product, sizeof(product));
   if (rc < 0)
     return rc;
 
-  printf("\tProductName : %s\n", data);
-
-  rc = rfidscan_getSerialNumber(dev, data, sizeof(data));
+  rc = rfidscan_getSerialNumber(dev, serial, sizeof(serial));
   if (rc < 0)
     return rc;
 
-  printf("\tSerialNumber: %s\n", data);
-
-  rc = rfidscan_getVersion(dev, data, sizeof(data));
+  rc = rfidscan_getVersion(dev, version, sizeof(version));
   if (rc < 0)
     return rc;
 
-  if (strlen(data) == 10)
-  {
-    printf("\tVersion     : %c%c.%c%c (SpringProx LIB %c%c.%c%c, build %c%c)\n",
-      data[0] != '0' ? data[0] : 0, data[1], data[2], data[3],
-      data[4] != '0' ? data[4] : 0, data[5], data[6], data[7],
-      data[8] != '0' ? data[8] : 0, data[9]);
-  } else
-  {
-    printf("\tVersion     : %s\n", data);
-  }
+  show_version(vendor, product, serial, version);
+
   return rc;
 }
 
 void show(uint8_t addr, uint8_t data[], int size, int show_empty)
 {
-  int i;
+  rfidscan_register reg;
+  char text[3 * rfidscan_register_max];
 
   if (size > 0)
   {
-    printf("%02X : ", addr);
-
-    if ((addr == 0x55) || (addr == 0x56) || (addr == 0x6F))
-    {
-      for (i=0; i<size; i++)
-        printf("XX");
-    } else
-    {
-      for (i=0; i<size; i++)
-        printf("%02X", data[i]);
-    }
-    printf("\n");
+    /* Secrets masked, symbols named, as the schema of the register says */
+    reg.addr = addr;
+    reg.size = (size < rfidscan_register_max) ? size : rfidscan_register_max;
+    memcpy(reg.data, data, reg.size);
+    if (rfidscan_decodeRegister(&reg, text, sizeof(text)) < 0)
+      text[0] = '\0';
+    out("%02X : %s\n", addr, text);
   } else
   if ((size == 0) && show_empty)
   {
-    printf("%02X : (empty)\n", addr);
+    out("%02X : (empty)\n", addr);
   }
 }
 
@@ -252,7 +281,7 @@ int do_write(rfidscan_device *dev, uint8_t addr, uint8_t *data, size_t size)
     {
       if (!retry)
       {
-        printf("%02X : write failed\n", addr);      
+        out("%02X : write failed\n", addr);      
         return -1;
       }
       continue;
@@ -264,7 +293,7 @@ int do_write(rfidscan_device *dev, uint8_t addr, uint8_t *data, size_t size)
       {
         if (!retry)
         {
-          printf("%02X : write error\n", addr);
+          out("%02X : write error\n", addr);
           return -1;
         }
         continue;
@@ -280,23 +309,88 @@ int do_write(rfidscan_device *dev, uint8_t addr, uint8_t *data, size_t size)
 }
 
 //
-int do_dump(rfidscan_device *dev)
+int do_write_many(rfidscan_device *dev, rfidscan_register regs[], int count)
 {
-  uint8_t addr;
+  rfidscan_register r_regs[256];
+  int i, rc;
+
+  if (count == 0)
+    return 0;
+
+  rc = rfidscan_RegisterWriteMany(dev, regs, count, r_regs, 0);
+  if (rc < 0)
+    return rc;
+
+  for (i=0; i<count; i++)
+  {
+    if ((r_regs[i].size == regs[i].size) && ((regs[i].size == 0) || !memcmp(r_regs[i].data, regs[i].data, regs[i].size)))
+      show(r_regs[i].addr, r_regs[i].data, r_regs[i].size, 1);
+    else
+      out("%02X : write error\n", regs[i].addr);
+  }
+
+  return (rc == 0) ? count : -1;
+}
+
+// write a register map as "10-1F,6F,A0", the syntax of --register-map
+static void format_map(const uint8_t map[], char *text, size_t size)
+{
+  size_t len = 0;
+  int addr, last;
+
+  text[0] = '\0';
+  for (addr=0; addr<=0xFF; addr++)
+  {
+    if (!rfidscan_register_mapped(map, addr))
+      continue;
+    for (last=addr; (last<0xFF) && rfidscan_register_mapped(map, last+1); last++)
+      ;
+    if (len + 7 >= size)
+      break;
+    len += sprintf(&text[len], (last == addr) ? "%s%02X" : "%s%02X-%02X", len ? "," : "", addr, last);
+    addr = last;
+  }
+}
+
+//
+int do_dump(rfidscan_device *dev, int all)
+{
+  rfidscan_register regs[254];
+  uint8_t map[rfidscan_register_map_size];
+  char text[256*3];
   int count = 0;
-  int rc;
+  int sparse;
+  int i, rc;
+
+  /* Only the registers the product can hold, unless --dump-all */
+  sparse = !all && (rfidscan_getRegisterMap(dev, map) == 0);
+  if (sparse)
+    rc = rfidscan_RegisterReadMap(dev, map, regs);
+  else
+    rc = rfidscan_RegisterReadRange(dev, 1, 254, regs);
+  if (rc < 0)
+    return rc;
 
-  for (addr=1; addr<255; addr++)
+  memset(map, 0, sizeof(map));
+  for (i=0; i<rc; i++)
   {
-    rc = do_read(dev, addr, 0);
-    if (rc < 0)
-      return rc;
-    if (rc > 0)
+    if (regs[i].size < 0)
+      return regs[i].size;
+    show(regs[i].addr, regs[i].data, regs[i].size, 0);
+    if (regs[i].size > 0)
+    {
+      rfidscan_register_map_set(map, regs[i].addr);
       count++;
+    }
   }
 
   if (!count)
-    printf("No register defined in this RFID Scanner\n");
+    out("No register defined in this RFID Scanner\n");
+  else if (all)
+  {
+    format_map(map, text, sizeof(text));
+    out("Register map: %s\n", text);
+  }
 
   return 0;
 }
@@ -305,34 +399,16 @@ int do_dump(rfidscan_device *dev)
 // 
 static uint8_t getopt_led(const char *s)
 {
-  if (!stricmp(s, "0") || !stricmp(s, "off")) return 0;
-  if (!stricmp(s, "1") || !stricmp(s, "on")) return 1;
-  if (!stricmp(s, "s") || !stricmp(s, "slow")) return 2;
-  if (!stricmp(s, "a") || !stricmp(s, "auto")) return 3;
-  if (!stricmp(s, "f") || !stricmp(s, "fast")) return 4;
-  if (!stricmp(s, "h") || !stricmp(s, "heart")) return 5;
-  if (!stricmp(s, "si") || !stricmp(s, "slowinv")) return 6;
-  if (!stricmp(s, "fi") || !stricmp(s, "fastinv")) return 7;
-  if (!stricmp(s, "hi") || !stricmp(s, "heartinv")) return 8;
-  if (!stricmp(s, "2") || !stricmp(s, "half")) return 9;
-  if (!stricmp(s, "2i") || !stricmp(s, "halfinv")) return 10;
-  if (!stricmp(s, "t") || !stricmp(s, "type")) return 11;
-  if (!stricmp(s, "rf") || !stricmp(s, "field")) return 12;
-  if (!stricmp(s, "d") || !stricmp(s, "default")) return 13;
-  if (!stricmp(s, "fl") || !stricmp(s, "float")) return 14;
-  if (!stricmp(s, "_") || !stricmp(s, "ignore")) return 15;
-  return 15;
+  int mode = rfidscan_encodeSymbol(rfidscan_led_modes, s);
+  return (mode >= 0) ? (uint8_t) mode : 15;  /* ignore */
 }
 
 // --------------------------------------------------------------------------- 
 // 
 static uint8_t getopt_layout(const char *s)
 {
-  if (!stricmp(s, "qwerty")) return 0x00;
-  if (!stricmp(s, "qwertz")) return 0x02;
-  if (!stricmp(s, "azerty-desktop") || !stricmp(s, "azerty-full")) return 0x01;
-  if (!stricmp(s, "azerty") || !stricmp(s, "azerty-laptop")) return 0x03;
-  return 0xFF;
+  int layout = rfidscan_encodeSymbol(rfidscan_layouts, s);
+  return (layout >= 0) ? (uint8_t) layout : 0xFF;
 }
 
 
@@ -357,10 +433,19 @@ static void usage(char *myName)
     "  --layout=<layout>    Set keyboard layout, supported layout values are:\n"
     "                         qwerty, azerty, qwertz\n"
     "  --read <addr>        Read a configuration register\n"
-    "  --dump               Read all configuration registers\n"
+    "  --dump               Read all configuration registers (only the ones of\n"
+    "                       the --register-map when given)\n"
+    "  --dump-all           Read the registers 01 to FE, and show their map\n"
     "  --write <addr>=<value>\n"
     "                       Write a configuration register\n"
-    "  --write-conf <file>  Write the configuration from a .multiconf file\n"
+    "  --write-conf <file>  Write the registers that differ from a .multiconf file\n"
+    "  --snapshot <file>    Save all the configuration registers in a snapshot file\n"
+    "                       (%%s in the name is replaced by the serial number)\n"
+    "  --restore <file>     Write the registers that differ from a snapshot file,\n"
+    "                       and erase the ones it does not hold\n"
+    "  --check-conf <file>  Check that the registers of a .multiconf file hold their\n"
+    "                       values, comparing fingerprints (exit status 1 if not),\n"
+    "                       and with erase=1 that the others are empty\n"
     "\n"
     "and [options] are: \n"
     "  -i <devices>  --id <all|deviceIds>\n"
@@ -370,6 +455,18 @@ static void usage(char *myName)
     "  -r, --reset          Reset the RFID Scanner when exiting\n"
     "  -p, --password <password>\n"
     "                       If the RFID Scanner is password-protected\n"
+    "  -j, --jobs <count>   Work on up to <count> RFID Scanners at the same time\n"
+    "                       (their output is shown in id order once all are done)\n"
+    "  --daemon[=<socket>]  Send the command to rfidscand, which keeps the RFID\n"
+    "                       Scanner(s) open (default socket $XDG_RUNTIME_DIR/\n"
+    "                       " RFIDSCAND_USER_SOCKET " if there is one, else " RFIDSCAND_SOCKET ")\n"
+    "  --backend <name>     Use this hidapi backend, when several are built in\n"
+    "                       (Linux: libusb or hidraw)\n"
+    "  --show-diff          With --check-conf, list the registers that differ\n"
+    "  --shadow             Read each register from the RFID Scanner(s) only once\n"
+    "  --register-map <addrs>\n"
+    "                       Registers the RFID Scanner(s) can hold, e.g. 10-1F,6F,A0\n"
+    "                       (as shown by --dump-all), --dump reads only these\n"
     "\n"
     "Examples\n"
     "  %s --leds fast,fastinv,off\n"
@@ -394,6 +491,7 @@ enum {
   OPT_DURING = 'd',
   OPT_PASSWORD = 'p',
   OPT_RESET = 'r',
+  OPT_JOBS = 'j',
   CMD_LEDS = 'l',
   CMD_BEEP = 'b',
   CMD_DUMMY = 127,
@@ -404,437 +502,1519 @@ enum {
   CMD_EEREAD,
   CMD_EEWRITE,
   CMD_EEDUMP,
+  CMD_EEDUMP_ALL,
   CMD_EEFILE,
+  CMD_SNAPSHOT,
+  CMD_RESTORE,
+  CMD_CHECKCONF,
   CMD_LAYOUT,
+  OPT_DAEMON,
+  OPT_BACKEND,
+  OPT_REGISTER_MAP,
+  OPT_SHOW_DIFF,
+  OPT_SHADOW,
 };
 
-//
-int main(int argc, char** argv)
-{
-  rfidscan_device* dev;
-  uint32_t  deviceIds[rfidscan_max_devices];
+// what to do on each device, from the command line
+static int cmd  = CMD_NONE;
+static int reset = 0;
 
-  int i, rc;
-  
-  int countDevices;
-  int numDevicesToUse = 0;
+static uint8_t leds_r = 0xD;
+static uint8_t leds_g = 0xD;
+static uint8_t leds_b = 0xD;
+static uint8_t layout = 0xFF;
 
-  uint8_t leds_r = 0xD;
-  uint8_t leds_g = 0xD;
-  uint8_t leds_b = 0xD;
-  uint8_t layout = 0xFF;
+static uint8_t register_addr = 0;
+static int register_size = 0;
+static uint8_t register_data[rfidscan_register_max];
 
-  uint8_t register_addr = 0;
-  int register_size = 0;
-  uint8_t register_data[64];
+static uint16_t during_ms = 0;
 
-  uint16_t during_ms = 0;
+static uint8_t password[2] = { 0xFF, 0xFF };
 
-  uint8_t password[2] = { 0xFF, 0xFF };
+static const char *config_file = NULL;
+static const char *snapshot_file = NULL;
+static int snapshot_pid = 0;  // product of the --restore snapshot
 
-  const char *config_file = NULL;
+static const char *daemon_socket = NULL;
+static const char *backend = NULL;
 
-  int cmd  = CMD_NONE;
-  int reset = 0;
+static int dump_all = 0;  // --dump-all: sweep all the addresses, ignore the register map
+static int show_diff = 0;  // --show-diff: list the registers --check-conf finds different
 
-  // parse options
-  int option_value, option_index = 0;
-  
-  const char *option_string = "i:qvrd:l:b:?";
-  static struct option option_list[] = {
-    {"help",         no_argument,       0,      CMD_HELP},
-    {"id",           required_argument, 0,      OPT_DEVICE},
-    {"ids",          required_argument, 0,      OPT_DEVICE},
-    {"quiet",        no_argument,       0,      OPT_QUIET},
-    {"verbose",      no_argument,       0,      OPT_VERBOSE},
-    {"reset",        no_argument,       0,      OPT_RESET},
-    {"password",     required_argument, 0,      OPT_PASSWORD},
-    {"during",       required_argument, 0,      OPT_DURING},
-    {"leds",         required_argument, 0,      CMD_LEDS},
-    {"leds-default", no_argument,       0,      CMD_LEDS_DEFAULT},
-    {"beep",         no_argument,       0,      CMD_BEEP},
-    {"list",         no_argument,       0,      CMD_LIST},
-    {"test",         no_argument,       0,      CMD_TEST},
-    {"version",      no_argument,       0,      CMD_VERSION},
-    {"read",         required_argument, 0,      CMD_EEREAD},
-    {"write",        required_argument, 0,      CMD_EEWRITE},
-    {"dump",         no_argument,       0,      CMD_EEDUMP},
-    {"write-conf",   required_argument, 0,      CMD_EEFILE},
-    {"layout",       required_argument, 0,      CMD_LAYOUT},
-    {NULL,           0,                 0,      0}
-  };
+// registers wanted by the .multiconf file, once parsed
+static rfidscan_register conf_regs[254];
+static int conf_index[256];  // index in conf_regs plus 1, 0 if not set
+static int conf_count = 0;
+static int conf_erase = 0;   // the registers not in conf_regs must be empty
 
-  while(1)
-  {
-    option_value = getopt_long(argc, argv, option_string, option_list, &option_index);
-    if (option_value==-1)
-      break; // parsed all the args
+// number of devices worked on at the same time
+#define max_jobs 64
+static int jobs = 1;
 
-    switch (option_value)
-    {
-      case CMD_TEST:
-        cmd = CMD_TEST;
-        break;
-      case CMD_LIST:
-        cmd = CMD_LIST;
-        break;
-      case CMD_VERSION:
-        cmd = CMD_VERSION;
-        break;
-      case CMD_LEDS:
-      case CMD_LEDS_DEFAULT:
-        cmd = CMD_LEDS;
-        if (optarg != NULL)
-        {
-          char *pch = strtok( optarg, " ,");
-          if (pch != NULL)
-          {
-            leds_r = getopt_led(pch);
-            pch = strtok(NULL, " ,");
-          }
-          if (pch != NULL)
-          {
-            leds_g = getopt_led(pch);
-            pch = strtok(NULL, " ,");
-          }
-          if (pch != NULL)
-          {
-            leds_b = getopt_led(pch);
-            pch = strtok(NULL, " ,");
-          }
-        }
-        break;
-      case CMD_BEEP:
-        cmd = CMD_BEEP;
-        break;
+// a device to work on, and the result
+typedef struct {
+  int index;       // in the list of devices to use
+  uint32_t id;     // as given to rfidscan_openById()
+  FILE *out;       // output of the device with --jobs
+  int rc;
+} device_job;
 
+static device_job job_list[rfidscan_max_devices];
+static int job_count = 0;
+static int job_next = 0;
 
-      case CMD_EEREAD :
-        cmd = CMD_EEREAD;
-        register_addr = htob(optarg);
-        if ((register_addr  == 0x00) || (register_addr  == 0xFF))
-        {
-          msg("Invalid register addr\n");
-          exit(EXIT_FAILURE);
-        }
-        break;
+#ifdef WIN32
+static CRITICAL_SECTION job_lock;
+#define job_lock_init() InitializeCriticalSection(&job_lock)
+#define job_lock_take() EnterCriticalSection(&job_lock)
+#define job_lock_give() LeaveCriticalSection(&job_lock)
+#else
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+#define job_lock_init()
+#define job_lock_take() pthread_mutex_lock(&job_lock)
+#define job_lock_give() pthread_mutex_unlock(&job_lock)
+#endif
 
-      case CMD_EEWRITE :
-        cmd = CMD_EEWRITE;
-        if (optarg != NULL)
-        {
-          char *pch = strtok( optarg, "=");
-          if (pch != NULL)
-          {
-            register_addr = htob(optarg);
-            if ((register_addr  == 0x00) || (register_addr  == 0xFF))
-            {
-              msg("Invalid register addr\n");
-              exit(EXIT_FAILURE);
-            }
-            pch = strtok(NULL, "=");
-          }
-          if (pch != NULL)
-          {
-            register_size = hstob(pch, register_data, sizeof(register_data));
-          }
-        }
-        break;
+// --------------------------------------------------------------------------- 
+// the register of the parsed .multiconf file at addr, a later line wins
+static rfidscan_register *conf_reg(uint8_t addr)
+{
+  rfidscan_register *reg;
 
-      case CMD_EEDUMP :
-        cmd = CMD_EEDUMP;
-        break;
+  if (conf_index[addr] == 0)
+    conf_index[addr] = ++conf_count;
 
-      case CMD_EEFILE :
-        cmd = CMD_EEFILE;
-        config_file = optarg;
-        break;
+  reg = &conf_regs[conf_index[addr] - 1];
+  memset(reg, 0, sizeof(rfidscan_register));
+  reg->addr = addr;
+  return reg;
+}
 
-      case CMD_LAYOUT :
-        cmd = CMD_LAYOUT;
-        if (optarg != NULL)
-          layout = getopt_layout(optarg);
-        if (layout == 0xFF)
-        {
-          msg("Invalid keyboard layout\n");
-          exit(EXIT_FAILURE);
-        }
-        break;
+// forget the registers, erase being the new value of conf_erase
+static void conf_clear(int erase)
+{
+  memset(conf_index, 0, sizeof(conf_index));
+  conf_count = 0;
+  conf_erase = erase;
+}
 
-      case OPT_DURING:
-        if (optarg != NULL)
-          during_ms = (uint16_t) strtol(optarg,NULL,10);
-        break;
+// --------------------------------------------------------------------------- 
+// Snapshot and plan files, integers big-endian. Every record has the same
+// size and offset of its own, so that a file can be mapped in memory as is:
+//
+//   header (64):   magic(8) version(2) header size(2) ...(4) count(2) ...(46)
+//   presence (32): one bit per register address, as rfidscan_register_mapped()
+//   records:       count times addr(1) size(1) value(62), in address order
+//
+// the rest of the header depends on the magic:
+//   "RFIDSNAP" (--snapshot):  vid(12) pid(14) serial(20, 12) firmware(32, 32)
+//   "RFIDPLAN" (.multiconf):  flags(12, bit 0 for erase=1) hash(20, 8)
+#define IMAGE_HEADER  64
+#define IMAGE_RECORD  64
+#define IMAGE_RECORDS (IMAGE_HEADER + rfidscan_register_map_size)
+
+#define SNAPSHOT_MAGIC   "RFIDSNAP"
+#define SNAPSHOT_VERSION 1
+#define PLAN_MAGIC       "RFIDPLAN"
+#define PLAN_VERSION     2  // 2: values checked against the register schema
+#define PLAN_ERASE       0x0001
+
+// write header, then regs (in address order) with their presence bitmap
+static int save_image(const char *name, uint8_t header[IMAGE_RECORDS], const rfidscan_register regs[], int count)
+{
+  uint8_t record[IMAGE_RECORD];
+  int i, rc;
+  FILE *fp;
 
-      case OPT_PASSWORD:
-        if (optarg != NULL)
-          hstob(optarg, password, 2);
-        break;
+  rfidscand_put16(&header[10], IMAGE_HEADER);
+  rfidscand_put16(&header[16], count);
+  memset(&header[IMAGE_HEADER], 0, rfidscan_register_map_size);
+  for (i=0; i<count; i++)
+    rfidscan_register_map_set(&header[IMAGE_HEADER], regs[i].addr);
 
-      case OPT_RESET :
-        reset++;
-        break;
+  fp = fopen(name, "wb");
+  if (fp == NULL)
+    return -1;
 
-      case OPT_QUIET:
-        if (optarg==NULL) quiet++;
-        else quiet = strtol(optarg,NULL,0);
-        break;
-      case OPT_VERBOSE:
-        if (optarg==NULL) rfidscan_verbose++;
-        else rfidscan_verbose = strtol(optarg,NULL,0);
-        if (rfidscan_verbose > 3)
-          fprintf(stderr,"going REALLY verbose\n");
-        break;
-      case OPT_DEVICE:
-        if( strcmp(optarg,"all") == 0 ) {
-          numDevicesToUse = 0; //rfidscan_max_devices;
-          for (i=0; i< rfidscan_max_devices; i++) {
-            deviceIds[i] = i;
-          }
-        } 
-        else { // if( strcmp(optarg,",") != -1 ) { // comma-separated list
-          char* pch;
-          int base = 0;
-          pch = strtok( optarg, " ,");
-          numDevicesToUse = 0;
-          while( pch != NULL ) { 
-            int base = (strlen(pch)==8) ? 16:0;
-            deviceIds[numDevicesToUse++] = strtol(pch,NULL,base);
-            pch = strtok(NULL, " ,");
-          }
-          for (i=0; i<numDevicesToUse; i++) { 
-            printf("deviceId[%d]: %d\n", i, deviceIds[i]);
-          }
-        }
-        break;
+  rc = (fwrite(header, IMAGE_RECORDS, 1, fp) == 1) ? 0 : -1;
+  for (i=0; (i<count) && (rc == 0); i++)
+  {
+    memset(record, 0, sizeof(record));
+    record[0] = regs[i].addr;
+    record[1] = (uint8_t) regs[i].size;
+    memcpy(&record[2], regs[i].data, regs[i].size);
+    rc = (fwrite(record, sizeof(record), 1, fp) == 1) ? 0 : -1;
+  }
 
-      case CMD_HELP:
-        usage("rfidscan-tool");
-        exit(EXIT_FAILURE);
-        break;
+  if (fclose(fp) != 0)
+    rc = -1;
+  return rc;
+}
 
-      default :
-        msg("Error while parsing the args\n");
-        exit(EXIT_FAILURE);
+// read the registers of a file written by save_image() as the registers
+// to write, return -1 if it can't be opened, -2 if it is not a magic file,
+// -3 if it is too recent for this tool, -4 if it is corrupted
+static int load_image(const char *name, const char *magic, int version, uint8_t header[IMAGE_RECORDS])
+{
+  uint8_t record[IMAGE_RECORD];
+  rfidscan_register *reg;
+  int count, addr, i;
+  int rc = 0;
+  FILE *fp;
+
+  fp = fopen(name, "rb");
+  if (fp == NULL)
+    return -1;
+
+  if ((fread(header, IMAGE_RECORDS, 1, fp) != 1) ||
+      memcmp(header, magic, 8) ||
+      (rfidscand_get16(&header[10]) != IMAGE_HEADER))
+    rc = -2;
+  else
+  if (rfidscand_get16(&header[8]) > version)
+    rc = -3;
+
+  /* The records must match the presence bitmap, one by one */
+  count = rfidscand_get16(&header[16]);
+  conf_clear(0);
+  addr = 0;
+  for (i=0; (i<count) && (rc == 0); i++)
+  {
+    while ((addr < 0xFF) && !rfidscan_register_mapped(&header[IMAGE_HEADER], addr))
+      addr++;
+
+    if ((addr == 0x00) || (addr >= 0xFF) ||
+        (fread(record, sizeof(record), 1, fp) != 1) ||
+        (record[0] != addr) || (record[1] > rfidscan_register_max))
+    {
+      rc = -4;
+      break;
     }
+
+    reg = conf_reg((uint8_t) addr);
+    reg->size = record[1];
+    memcpy(reg->data, &record[2], reg->size);
+    addr++;
   }
 
-  if (cmd == CMD_NONE)
+  fclose(fp);
+  return rc;
+}
+
+// --------------------------------------------------------------------------- 
+// length of the value hstob() reads from str, -1 if str is not a valid
+// value of up to size bytes
+static int check_value(const char *str, int size)
+{
+  int len = 0;
+
+  while ((*str == '=') || (*str == ':') || (*str == ' ') || (*str == '\t'))
+    str++;
+
+  if (*str == '@')
   {
-    usage("rfidscan-tool");
-    exit(EXIT_FAILURE);
+    /* ASCII mode */
+    len = (int) strlen(str + 1);
+  } else
+  {
+    /* Hexadecimal mode, bytes may be separated like hstob() allows */
+    while (*str != '\0')
+    {
+      if (!isxdigit((unsigned char) str[0]) || !isxdigit((unsigned char) str[1]))
+        return -1;
+      len++;
+      str += 2;
+      while ((*str == ' ') || (*str == '\t') || (*str == '.') || (*str == ':'))
+        str++;
+    }
   }
 
-  /* Get a list of all devices and their paths */
-  countDevices = rfidscan_enumerate();
-  if (countDevices == 0)
+  return (len <= size) ? len : -1;
+}
+
+// value of a register, from the command line or a .multiconf file: the
+// name of one of its symbols, or its bytes as hstob() reads them
+static int parse_value(uint8_t addr, const char *str, rfidscan_register *reg)
+{
+  while ((*str == '=') || (*str == ':') || (*str == ' ') || (*str == '\t'))
+    str++;
+
+  if (rfidscan_encodeRegister(addr, str, reg) == 0)
+    return 0;
+
+  reg->addr = addr;
+  reg->size = 0;
+  if (check_value(str, rfidscan_register_max) < 0)
+    return -1;
+  reg->size = hstob(str, reg->data, sizeof(reg->data));
+
+  /* Sizes and symbols of the registers rfidscan-lib knows */
+  return rfidscan_checkRegister(reg);
+}
+
+// parse the whole .multiconf text into the registers to write,
+// or fail at the first invalid line
+static int compile_conf(const char *file, char *text)
+{
+  int general_section = 0;
+  int raw_section = 0;
+  rfidscan_register *reg;
+  char *line, *next, *value;
+  size_t len;
+  int line_no = 0;
+
+  conf_clear(0);
+
+  for (line=text; line!=NULL; line=next)
   {
-    msg("No RFID Scanner found\n");
-    exit(EXIT_FAILURE);
+    next = strchr(line, '\n');
+    if (next != NULL)
+      *next++ = '\0';
+    line_no++;
+
+    /* Strip the comments and the blanks around the line */
+    line[strcspn(line, "#;\r")] = '\0';
+    while ((*line == ' ') || (*line == '\t'))
+      line++;
+    len = strlen(line);
+    while ((len > 0) && ((line[len-1] == ' ') || (line[len-1] == '\t')))
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+
+    if (!stricmp(line, "[general]"))
+    {
+      raw_section = 0;
+      general_section = 1;
+    } else
+    if (!stricmp(line, "[raw]"))
+    {
+      general_section = 0;
+      raw_section = 1;
+    } else
+    if (line[0] == '[')
+    {
+      general_section = 0;
+      raw_section = 0;
+    } else
+    if (!stricmp(line, "erase=1") && (general_section || raw_section))
+    {
+      /* Forget the values seen so far, and empty the other registers */
+      conf_clear(1);
+    } else
+    if (raw_section)
+    {
+      value = strchr(line, '=');
+      if ((value != line + 2) || !isxdigit((unsigned char) line[0]) || !isxdigit((unsigned char) line[1]) ||
+          (htob(line) == 0x00) || (htob(line) == 0xFF))
+      {
+        msg("%s:%d: invalid register address\n", file, line_no);
+        return -1;
+      }
+      reg = conf_reg(htob(line));
+      if (parse_value(reg->addr, value + 1, reg) < 0)
+      {
+        msg("%s:%d: invalid register value\n", file, line_no);
+        return -1;
+      }
+    }
   }
 
-  msg("%d RFID Scanner(s) found\n", countDevices);
+  return 0;
+}
 
-  if (cmd == CMD_LIST)
+// 64-bit FNV-1a of the .multiconf text, the key of its plan
+static uint64_t hash_conf(const char *text, size_t size)
+{
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  size_t i;
+
+  for (i=0; i<size; i++)
   {
-    for (i=0; i<countDevices; i++)
+    hash ^= (uint8_t) text[i];
+    hash *= 0x100000001B3ULL;
+  }
+
+  return hash;
+}
+
+// name of the cached plan of a .multiconf text, 0 if there is no cache directory
+static int plan_name(uint64_t hash, char *name, size_t size)
+{
+  const char *dir;
+  char path[512];
+
+#ifdef WIN32
+  dir = getenv("LOCALAPPDATA");
+  if (dir == NULL)
+    return 0;
+  snprintf(path, sizeof(path), "%s\\rfidscan", dir);
+  _mkdir(path);
+#else
+  dir = getenv("XDG_CACHE_HOME");
+  if ((dir != NULL) && (dir[0] != '\0'))
+    snprintf(path, sizeof(path), "%s", dir);
+  else
+  {
+    dir = getenv("HOME");
+    if (dir == NULL)
+      return 0;
+    snprintf(path, sizeof(path), "%s/.cache", dir);
+  }
+  mkdir(path, 0700);
+  strncat(path, "/rfidscan", sizeof(path) - strlen(path) - 1);
+  mkdir(path, 0700);
+#endif
+
+  snprintf(name, size, "%s/%08X%08X.plan", path, (unsigned) (hash >> 32), (unsigned) hash);
+  return 1;
+}
+
+// load the .multiconf file once, before working on the devices: from its
+// cached plan when the text has not changed, compiling it otherwise
+static int load_conf(const char *file)
+{
+  rfidscan_register regs[254];
+  uint8_t header[IMAGE_RECORDS];
+  char name[600];
+  char *text;
+  size_t size;
+  uint64_t hash;
+  int cached, addr, count;
+  FILE *fp;
+
+  fp = fopen(file, "rb");
+  if (fp == NULL)
+  {
+    msg("Failed to open the configuration file '%s'\n", file);
+    return -1;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  size = (size_t) ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  text = malloc(size + 1);
+  if ((text == NULL) || (fread(text, 1, size, fp) != size))
+  {
+    msg("Failed to read the configuration file '%s'\n", file);
+    free(text);
+    fclose(fp);
+    return -1;
+  }
+  text[size] = '\0';
+  fclose(fp);
+
+  hash = hash_conf(text, size);
+  cached = plan_name(hash, name, sizeof(name));
+
+  if (cached && (load_image(name, PLAN_MAGIC, PLAN_VERSION, header) == 0) &&
+      (rfidscand_get16(&header[8]) == PLAN_VERSION) &&
+      (rfidscand_get32(&header[20]) == (uint32_t) (hash >> 32)) &&
+      (rfidscand_get32(&header[24]) == (uint32_t) hash))
+  {
+    conf_erase = rfidscand_get16(&header[12]) & PLAN_ERASE;
+    free(text);
+    return 0;
+  }
+
+  if (compile_conf(file, text) < 0)
+  {
+    free(text);
+    return -1;
+  }
+  free(text);
+
+  /* Save the plan for the next time, the registers in address order */
+  if (cached)
+  {
+    count = 0;
+    for (addr=0x01; addr<=0xFE; addr++)
     {
-      printf("id:%d - VID: %04X, PID: %04X, serial number: %s\n", i, rfidscan_getCachedVid(i), rfidscan_getCachedPid(i), rfidscan_getCachedSerial(i));
+      if (conf_index[addr])
+        regs[count++] = conf_regs[conf_index[addr] - 1];
     }
 
-    exit(EXIT_SUCCESS);
+    memset(header, 0, sizeof(header));
+    memcpy(&header[0], PLAN_MAGIC, 8);
+    rfidscand_put16(&header[8], PLAN_VERSION);
+    rfidscand_put16(&header[12], conf_erase ? PLAN_ERASE : 0);
+    rfidscand_put32(&header[20], (uint32_t) (hash >> 32));
+    rfidscand_put32(&header[24], (uint32_t) hash);
+    if (save_image(name, header, regs, count) < 0)
+      remove(name);
   }
 
-  if (numDevicesToUse == 0)
+  return 0;
+}
+
+// write only the registers that differ from the .multiconf file,
+// return the number of registers written
+static int do_write_conf(rfidscan_device *dev)
+{
+  rfidscan_register changed[254];
+  const rfidscan_register *reg;
+  int written = 0;
+  int i, rc;
+
+  rc = rfidscan_RegisterSync(dev, conf_regs, conf_count, conf_erase, changed, &written);
+  if (rc < 0)
+    return rc;
+
+  msg("%d register(s) to change\n", written);
+
+  for (i=0; i<written; i++)
+  {
+    if (conf_index[changed[i].addr])
+      reg = &conf_regs[conf_index[changed[i].addr] - 1];
+    else
+      reg = NULL;  // erased
+
+    if ((reg == NULL) ? (changed[i].size == 0) :
+        ((changed[i].size == reg->size) && ((reg->size == 0) || !memcmp(changed[i].data, reg->data, reg->size))))
+      show(changed[i].addr, changed[i].data, changed[i].size, 1);
+    else
+      out("%02X : write error\n", changed[i].addr);
+  }
+
+  return (rc == 0) ? written : -1;
+}
+
+// compare the fingerprint of the registers of the .multiconf file to the
+// one of their values in the device, return 1 if they differ
+static int do_check_conf(rfidscan_device *dev)
+{
+  static const rfidscan_register empty;
+  rfidscan_register regs[254];
+  uint8_t map[rfidscan_register_map_size];
+  uint64_t expected, fingerprint;
+  const rfidscan_register *reg;
+  int i, count;
+
+  /* Only the registers of the file are read, unless the file erases the
+     others: then they are read as well (the ones of the register map of
+     the device, if it has one), so that a register set outside the file
+     shows in the fingerprint. The expected fingerprint stays the one of
+     the file, as the empty registers do not count in it */
+  memset(map, 0, sizeof(map));
+  if (conf_erase && (rfidscan_getRegisterMap(dev, map) < 0))
+  {
+    for (i=0x01; i<=0xFE; i++)
+      rfidscan_register_map_set(map, i);
+  }
+  for (i=0; i<conf_count; i++)
+    rfidscan_register_map_set(map, conf_regs[i].addr);
+
+  count = rfidscan_RegisterFingerprint(dev, map, &fingerprint, regs);
+  if (count < 0)
+    return count;
+
+  expected = rfidscan_fingerprintRegisters(conf_regs, conf_count);
+  if (fingerprint == expected)
+  {
+    out("Fingerprint %08X%08X, as expected\n", (unsigned) (fingerprint >> 32), (unsigned) fingerprint);
+    return 0;
+  }
+
+  out("Fingerprint %08X%08X, %08X%08X expected\n", (unsigned) (fingerprint >> 32), (unsigned) fingerprint,
+    (unsigned) (expected >> 32), (unsigned) expected);
+
+  if (show_diff)
+  {
+    for (i=0; i<count; i++)
+    {
+      reg = conf_index[regs[i].addr] ? &conf_regs[conf_index[regs[i].addr] - 1] : &empty;
+      if ((regs[i].size == reg->size) && ((reg->size == 0) || !memcmp(regs[i].data, reg->data, reg->size)))
+        continue;
+      if (regs[i].size >= 0)
+        show(regs[i].addr, regs[i].data, regs[i].size, 1);
+      else
+        out("%02X : read error\n", regs[i].addr);
+    }
+  }
+
+  return 1;
+}
+
+// --------------------------------------------------------------------------- 
+// name of the snapshot of a device, the first %s replaced by its serial
+static void snapshot_name(const char *serial, char *name, size_t size)
+{
+  const char *pch = strstr(snapshot_file, "%s");
+
+  if (pch == NULL)
+    snprintf(name, size, "%s", snapshot_file);
+  else
+    snprintf(name, size, "%.*s%s%s", (int) (pch - snapshot_file), snapshot_file, serial, pch + 2);
+}
+
+// save the registers set in the snapshot file of the device
+static int do_snapshot(rfidscan_device *dev)
+{
+  rfidscan_register regs[254];
+  uint8_t map[rfidscan_register_map_size];
+  uint8_t header[IMAGE_RECORDS];
+  char version[64], name[512];
+  const char *serial;
+  int index, count = 0;
+  int i, rc;
+
+  serial = rfidscan_getSerialForDev(dev);
+  if (serial == NULL)
+    return -1;
+  rc = rfidscan_getVersion(dev, version, sizeof(version));
+  if (rc < 0)
+    return rc;
+
+  /* Only the registers the product can hold, when a map is given */
+  if (rfidscan_getRegisterMap(dev, map) == 0)
+    rc = rfidscan_RegisterReadMap(dev, map, regs);
+  else
+    rc = rfidscan_RegisterReadRange(dev, 1, 254, regs);
+  if (rc < 0)
+    return rc;
+
+  for (i=0; i<rc; i++)
+  {
+    if (regs[i].size < 0)
+      return regs[i].size;
+    if (regs[i].size > 0)
+      regs[count++] = regs[i];
+  }
+
+  index = rfidscan_getCacheIndexByDev(dev);
+
+  memset(header, 0, sizeof(header));
+  memcpy(&header[0], SNAPSHOT_MAGIC, 8);
+  rfidscand_put16(&header[8], SNAPSHOT_VERSION);
+  rfidscand_put16(&header[12], rfidscan_getCachedVid(index));
+  rfidscand_put16(&header[14], rfidscan_getCachedPid(index));
+  strncpy((char *) &header[20], serial, 12);
+  strncpy((char *) &header[32], version, 32);
+
+  snapshot_name(serial, name, sizeof(name));
+  if (save_image(name, header, regs, count) < 0)
+  {
+    msg("Failed to write the snapshot file '%s'\n", name);
+    return -1;
+  }
+
+  out("%d register(s) saved in %s\n", count, name);
+  return count;
+}
+
+// load the snapshot file once, before working on the devices: its registers
+// are written the way a .multiconf with erase=1 is
+static int load_snapshot(const char *file)
+{
+  uint8_t header[IMAGE_RECORDS];
+
+  switch (load_image(file, SNAPSHOT_MAGIC, SNAPSHOT_VERSION, header))
+  {
+    case 0 :
+      break;
+    case -1 :
+      msg("Failed to open the snapshot file '%s'\n", file);
+      return -1;
+    case -2 :
+      msg("'%s' is not a snapshot file\n", file);
+      return -1;
+    case -3 :
+      msg("The snapshot file '%s' is too recent for this tool\n", file);
+      return -1;
+    default :
+      msg("The snapshot file '%s' is corrupted\n", file);
+      return -1;
+  }
+
+  snapshot_pid = rfidscand_get16(&header[14]);
+  conf_erase = 1;
+  return 0;
+}
+// --------------------------------------------------------------------------- 
+// open one device, run the command on it and close it
+static int run_device(device_job *job)
+{
+  rfidscan_device* dev;
+  int i = job->index;
+  int apply = reset;
+  int rc = 0;
+
+  dev = rfidscan_openById(job->id);
+  if (dev == NULL)
+  {
+    msg("Failed to open RFID Scanner with id:%d/%d\n", i+1, job_count);
+    return -1;
+  }
+
+  if (job_count > 1)
+    msg("Working on RFID Scanner with id:%d/%d\n", i+1, job_count);
+
+  switch (cmd)
+  {
+    case CMD_LEDS :
+    case CMD_BEEP :
+    case CMD_VERSION :
+      break;
+
+    default :
+      /* Check password */
+      {
+        uint8_t buffer[2];
+        rc = rfidscan_RegisterRead(dev, rfidscan_reg_password, buffer, sizeof(buffer));
+
+        if (rc > 0) 
+        {
+          if ((rc != 2) || ((buffer[0] == 0xFF) && (buffer[1] == 0xFF)))
+          {
+            msg("This RFID Scanner has been locked\n");
+            rfidscan_close(dev);
+            return -1;
+          }
+
+          if ((password[0] == 0xFF) && (password[1]))
+          {
+            msg("This RFID Scanner is password-protected\n");
+            msg("Use the --password <password> option to login\n");
+            rfidscan_close(dev);
+            return -1;
+          }
+
+          if (memcmp(password, buffer, 2))
+          {
+            msg("Wrong password\n");
+            rfidscan_close(dev);
+            return -1;
+          }
+
+          msg("Password is OK!\n");
+        }
+      }
+  }
+
+  switch (cmd)
+  {
+    case CMD_LEDS :
+      if (during_ms != 0)
+        rc = rfidscan_setLedsT(dev, leds_r, leds_g, leds_b, during_ms);
+      else
+        rc = rfidscan_setLedsP(dev, leds_r, leds_g, leds_b);
+      break;
+    case CMD_BEEP :
+      if (during_ms != 0)
+        rc = rfidscan_setBuzzer(dev, during_ms);
+      else
+        rc = rfidscan_setBuzzer(dev, 30);
+      break;
+    case CMD_VERSION :
+      msg("Querying RFID Scanner with id:%d/%d\n", i+1, job_count);
+      msg("\tVendorID    : %04X\n", rfidscan_getCachedVid(i));
+      msg("\tProductID   : %04X\n", rfidscan_getCachedPid(i));
+      rc = do_get_version(dev);
+      break;
+
+    case CMD_TEST :
+      msg("Testing RFID Scanner width id:%d/%d\n", i+1, job_count);
+      rc = do_test(dev);
+      break;
+
+    case CMD_EEDUMP :
+      rc = do_dump(dev, dump_all);
+      break;
+
+    case CMD_LAYOUT :
+      msg("Setting new keyboard layout\n");
+      rc = do_write(dev, rfidscan_reg_layout, &layout, 1);
+      break;
+
+    case CMD_EEREAD :
+      rc = do_read(dev, register_addr, 1);
+      break;
+
+    case CMD_EEWRITE :
+      rc = do_write(dev, register_addr, register_data, register_size);
+      break;
+
+    case CMD_EEFILE :
+      rc = do_write_conf(dev);
+      break;
+
+    case CMD_SNAPSHOT :
+      rc = do_snapshot(dev);
+      break;
+
+    case CMD_CHECKCONF :
+      rc = do_check_conf(dev);
+      break;
+
+    case CMD_RESTORE :
+      if (rfidscan_getCachedPid(rfidscan_getCacheIndexByDev(dev)) != snapshot_pid)
+      {
+        msg("The snapshot has been taken from another product\n");
+        rc = -1;
+        break;
+      }
+      rc = do_write_conf(dev);
+      break;
+
+    default :
+      msg("Internal error\n");
+      rc = -1;
+  }
+
+  /* Nothing written, the settings in use are already the right ones */
+  if (((cmd == CMD_EEFILE) || (cmd == CMD_RESTORE)) && (rc == 0))
+    apply = 0;
+
+  if (apply && (rc >= 0))
+  {
+    msg("Applying the new settings...\n");
+    rc = rfidscan_ApplyConfig(dev);
+  }
+
+  if (rc < 0)
+    msg("An error has occured\n");
+
+  rfidscan_close(dev);
+
+  return rc;
+}
+
+//
+static device_job *next_job(void)
+{
+  device_job *job = NULL;
+
+  job_lock_take();
+  if (job_next < job_count)
+    job = &job_list[job_next++];
+  job_lock_give();
+
+  return job;
+}
+
+// take the devices one after the other until none is left
+#ifdef WIN32
+static DWORD WINAPI worker(LPVOID param)
+#else
+static void *worker(void *param)
+#endif
+{
+  device_job *job;
+
+  while ((job = next_job()) != NULL)
+  {
+    out_fp = job->out;
+    job->rc = run_device(job);
+  }
+  out_fp = NULL;
+
+  return 0;
+}
+
+// run the command on all the devices with a pool of workers, then show
+// the output of each device in order. Returns the number of failures
+static int run_parallel(void)
+{
+#ifdef WIN32
+  HANDLE threads[max_jobs];
+#else
+  pthread_t threads[max_jobs];
+#endif
+  int started = 0;
+  int failed = 0;
+  int count = (jobs < job_count) ? jobs : job_count;
+  int i, c;
+
+  for (i=0; i<job_count; i++)
+    job_list[i].out = tmpfile(); /* NULL: straight to stdout */
+
+  job_lock_init();
+  job_next = 0;
+
+  /* The main thread is one of the workers */
+  for (i=1; i<count; i++)
+  {
+#ifdef WIN32
+    threads[started] = CreateThread(NULL, 0, worker, NULL, 0, NULL);
+    if (threads[started] == NULL)
+      break;
+#else
+    if (pthread_create(&threads[started], NULL, worker, NULL) != 0)
+      break;
+#endif
+    started++;
+  }
+  worker(NULL);
+
+  for (i=0; i<started; i++)
+  {
+#ifdef WIN32
+    WaitForSingleObject(threads[i], INFINITE);
+    CloseHandle(threads[i]);
+#else
+    pthread_join(threads[i], NULL);
+#endif
+  }
+
+  for (i=0; i<job_count; i++)
+  {
+    if (job_list[i].out != NULL)
+    {
+      rewind(job_list[i].out);
+      while ((c = fgetc(job_list[i].out)) != EOF)
+        putchar(c);
+      fclose(job_list[i].out);
+      job_list[i].out = NULL;
+    }
+    if (job_list[i].rc < 0)
+      failed++;
+  }
+
+  return failed;
+}
+
+#ifndef WIN32
+// --------------------------------------------------------------------------- 
+// client mode: the command is sent to rfidscand, which keeps the readers open
+static int daemon_fd = -1;
+static uint8_t daemon_answer[RFIDSCAND_ANSWER_MAX + 1];
+
+static int read_full(int fd, uint8_t *data, int len)
+{
+  int rc;
+
+  while (len > 0)
+  {
+    rc = read(fd, data, len);
+    if (rc <= 0)
+      return -1;
+    data += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const uint8_t *data, int len)
+{
+  int rc;
+
+  while (len > 0)
+  {
+    rc = write(fd, data, len);
+    if (rc <= 0)
+      return -1;
+    data += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+// the socket of a daemon run by the user if there is one, else the one of
+// the daemon run by root
+static const char *daemon_default_socket(void)
+{
+  static char path[256];
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  struct stat st;
+
+  if ((dir != NULL) && (dir[0] != '\0'))
+  {
+    snprintf(path, sizeof(path), "%s/" RFIDSCAND_USER_SOCKET, dir);
+    if (stat(path, &st) == 0)
+      return path;
+  }
+  return RFIDSCAND_SOCKET;
+}
+
+// the password goes to the daemon: only trust one run by root or by us
+static int daemon_check_peer(int fd)
+{
+  uid_t uid;
+#ifdef SO_PEERCRED
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return -1;
+  uid = cred.uid;
+#else
+  gid_t gid;
+
+  if (getpeereid(fd, &uid, &gid) < 0)
+    return -1;
+#endif
+  if ((uid != 0) && (uid != geteuid()))
+  {
+    msg("rfidscand is run by another user (uid %d)\n", (int) uid);
+    return -1;
+  }
+  return 0;
+}
+
+// send a request, the answer is left in daemon_answer. Returns its status
+static int daemon_request(uint8_t op, uint32_t id, const uint8_t *payload, int len, int *size)
+{
+  uint8_t req[RFIDSCAND_REQUEST_HEADER + RFIDSCAND_REQUEST_MAX];
+  uint8_t header[RFIDSCAND_ANSWER_HEADER];
+
+  req[0] = op;
+  rfidscand_put16(&req[1], len);
+  rfidscand_put32(&req[3], id);
+  memcpy(&req[7], password, 2);
+  if (len > 0)
+    memcpy(&req[RFIDSCAND_REQUEST_HEADER], payload, len);
+
+  if (write_full(daemon_fd, req, RFIDSCAND_REQUEST_HEADER + len) < 0)
+    return -1;
+  if (read_full(daemon_fd, header, sizeof(header)) < 0)
+    return -1;
+  *size = rfidscand_get16(&header[1]);
+  if (read_full(daemon_fd, daemon_answer, *size) < 0)
+    return -1;
+  daemon_answer[*size] = '\0';
+
+  return header[0];
+}
+
+//
+static int run_daemon_client(const char *path, uint32_t deviceIds[], int numDevicesToUse)
+{
+  struct sockaddr_un addr;
+  uint8_t payload[RFIDSCAND_REQUEST_MAX];
+  uint8_t op = 0;
+  int i, len, size, status, count;
+
+  if (reset || dump_all || (cmd == CMD_TEST) || (cmd == CMD_EEFILE) ||
+      (cmd == CMD_SNAPSHOT) || (cmd == CMD_RESTORE) || (cmd == CMD_CHECKCONF))
+  {
+    msg("This command is not available through rfidscand\n");
+    return -1;
+  }
+
+  if (path[0] == '\0')
+    path = daemon_default_socket();
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  daemon_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((daemon_fd < 0) || (connect(daemon_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0))
+  {
+    msg("Failed to connect to rfidscand on '%s'\n", path);
+    return -1;
+  }
+  if (daemon_check_peer(daemon_fd) < 0)
+  {
+    msg("Not sending anything to '%s'\n", path);
+    return -1;
+  }
+
+  if ((cmd == CMD_LIST) || (numDevicesToUse == 0))
+  {
+    status = daemon_request(RFIDSCAND_OP_LIST, 0, NULL, 0, &size);
+    if (status != RFIDSCAND_OK)
+    {
+      msg("An error has occured\n");
+      return -1;
+    }
+
+    count = 0;
+    for (i=0; i<size; i += 4 + strlen((char *) &daemon_answer[i + 4]) + 1)
+    {
+      if (cmd == CMD_LIST)
+        printf("id:%d - VID: %04X, PID: %04X, serial number: %s\n", count,
+          rfidscand_get16(&daemon_answer[i]), rfidscand_get16(&daemon_answer[i + 2]),
+          (char *) &daemon_answer[i + 4]);
+      count++;
+    }
+
+    if (count == 0)
+    {
+      msg("No RFID Scanner found\n");
+      return -1;
+    }
+    if (cmd == CMD_LIST)
+      return 0;
+
+    msg("%d RFID Scanner(s) found\n", count);
+
+    if (count > rfidscan_max_devices)
+      count = rfidscan_max_devices;
+    for (i=0; i<count; i++)
+      deviceIds[i] = i;
+    numDevicesToUse = count;
+  }
+
+  for (i=0; i<numDevicesToUse; i++)
+  {
+    if (numDevicesToUse > 1)
+      msg("Working on RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
+
+    len = 0;
+    switch (cmd)
+    {
+      case CMD_LEDS :
+        op = RFIDSCAND_OP_LEDS;
+        payload[0] = leds_r;
+        payload[1] = leds_g;
+        payload[2] = leds_b;
+        rfidscand_put16(&payload[3], during_ms);
+        len = 5;
+        break;
+      case CMD_BEEP :
+        op = RFIDSCAND_OP_BEEP;
+        rfidscand_put16(&payload[0], (during_ms != 0) ? during_ms : 30);
+        len = 2;
+        break;
+      case CMD_VERSION :
+        msg("Querying RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
+        op = RFIDSCAND_OP_VERSION;
+        break;
+      case CMD_EEDUMP :
+        op = RFIDSCAND_OP_DUMP;
+        break;
+      case CMD_LAYOUT :
+        msg("Setting new keyboard layout\n");
+        op = RFIDSCAND_OP_WRITE;
+        payload[0] = rfidscan_reg_layout;
+        payload[1] = layout;
+        len = 2;
+        break;
+      case CMD_EEREAD :
+        op = RFIDSCAND_OP_READ;
+        payload[0] = register_addr;
+        len = 1;
+        break;
+      case CMD_EEWRITE :
+        op = RFIDSCAND_OP_WRITE;
+        payload[0] = register_addr;
+        memcpy(&payload[1], register_data, register_size);
+        len = 1 + register_size;
+        break;
+    }
+
+    status = daemon_request(op, deviceIds[i], payload, len, &size);
+
+    switch (status)
+    {
+      case RFIDSCAND_OK :
+        if (op == RFIDSCAND_OP_VERSION)
+        {
+          const char *vendor = (char *) &daemon_answer[4];
+          const char *product = vendor + strlen(vendor) + 1;
+          const char *serial = product + strlen(product) + 1;
+          const char *version = serial + strlen(serial) + 1;
+
+          msg("\tVendorID    : %04X\n", rfidscand_get16(&daemon_answer[0]));
+          msg("\tProductID   : %04X\n", rfidscand_get16(&daemon_answer[2]));
+          show_version(vendor, product, serial, version);
+        } else
+        if (op == RFIDSCAND_OP_DUMP)
+        {
+          int j;
+          for (j=0; j+1<size; j += 2 + daemon_answer[j + 1])
+            show(daemon_answer[j], &daemon_answer[j + 2], daemon_answer[j + 1], 0);
+          if (size == 0)
+            out("No register defined in this RFID Scanner\n");
+        } else
+        if ((op == RFIDSCAND_OP_READ) || (op == RFIDSCAND_OP_WRITE))
+        {
+          show(payload[0], daemon_answer, size, 1);
+        }
+        break;
+      case RFIDSCAND_WRITE_FAILED :
+        out("%02X : write error\n", payload[0]);
+        break;
+      case RFIDSCAND_NO_DEVICE :
+        msg("Failed to open RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
+        break;
+      case RFIDSCAND_LOCKED :
+        msg("This RFID Scanner has been locked\n");
+        break;
+      case RFIDSCAND_PASSWORD_REQUIRED :
+        msg("This RFID Scanner is password-protected\n");
+        msg("Use the --password <password> option to login\n");
+        break;
+      case RFIDSCAND_WRONG_PASSWORD :
+        msg("Wrong password\n");
+        break;
+      default :
+        msg("An error has occured\n");
+    }
+
+    if (status != RFIDSCAND_OK)
+      return -1;
+  }
+
+  close(daemon_fd);
+  return 0;
+}
+#endif
+
+//
+int main(int argc, char** argv)
+{
+  uint32_t  deviceIds[rfidscan_max_devices];
+
+  int i;
+  
+  int countDevices;
+  int numDevicesToUse = 0;
+
+  // parse options
+  int option_value, option_index = 0;
+  
+  const char *option_string = "i:qvrj:d:l:b:?";
+  static struct option option_list[] = {
+    {"help",         no_argument,       0,      CMD_HELP},
+    {"id",           required_argument, 0,      OPT_DEVICE},
+    {"ids",          required_argument, 0,      OPT_DEVICE},
+    {"quiet",        no_argument,       0,      OPT_QUIET},
+    {"verbose",      no_argument,       0,      OPT_VERBOSE},
+    {"reset",        no_argument,       0,      OPT_RESET},
+    {"password",     required_argument, 0,      OPT_PASSWORD},
+    {"jobs",         required_argument, 0,      OPT_JOBS},
+    {"daemon",       optional_argument, 0,      OPT_DAEMON},
+    {"backend",      required_argument, 0,      OPT_BACKEND},
+    {"register-map", required_argument, 0,      OPT_REGISTER_MAP},
+    {"show-diff",    no_argument,       0,      OPT_SHOW_DIFF},
+    {"shadow",       no_argument,       0,      OPT_SHADOW},
+    {"during",       required_argument, 0,      OPT_DURING},
+    {"leds",         required_argument, 0,      CMD_LEDS},
+    {"leds-default", no_argument,       0,      CMD_LEDS_DEFAULT},
+    {"beep",         no_argument,       0,      CMD_BEEP},
+    {"list",         no_argument,       0,      CMD_LIST},
+    {"test",         no_argument,       0,      CMD_TEST},
+    {"version",      no_argument,       0,      CMD_VERSION},
+    {"read",         required_argument, 0,      CMD_EEREAD},
+    {"write",        required_argument, 0,      CMD_EEWRITE},
+    {"dump",         no_argument,       0,      CMD_EEDUMP},
+    {"dump-all",     no_argument,       0,      CMD_EEDUMP_ALL},
+    {"write-conf",   required_argument, 0,      CMD_EEFILE},
+    {"snapshot",     required_argument, 0,      CMD_SNAPSHOT},
+    {"restore",      required_argument, 0,      CMD_RESTORE},
+    {"check-conf",   required_argument, 0,      CMD_CHECKCONF},
+    {"layout",       required_argument, 0,      CMD_LAYOUT},
+    {NULL,           0,                 0,      0}
+  };
+
+  while(1)
   {
-    for (i=0; i<countDevices; i++)
-      deviceIds[i] = i;
-    numDevicesToUse = countDevices;
-  }
+    option_value = getopt_long(argc, argv, option_string, option_list, &option_index);
+    if (option_value==-1)
+      break; // parsed all the args
 
-  for (i=0; i<numDevicesToUse; i++)
-  {
-    dev = rfidscan_openById(deviceIds[i]);
-    if (dev == NULL)
+    switch (option_value)
     {
-      msg("Failed to open RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
-      exit(EXIT_FAILURE);
-    }
+      case CMD_TEST:
+        cmd = CMD_TEST;
+        break;
+      case CMD_LIST:
+        cmd = CMD_LIST;
+        break;
+      case CMD_VERSION:
+        cmd = CMD_VERSION;
+        break;
+      case CMD_LEDS:
+      case CMD_LEDS_DEFAULT:
+        cmd = CMD_LEDS;
+        if (optarg != NULL)
+        {
+          char *pch = strtok( optarg, " ,");
+          if (pch != NULL)
+          {
+            leds_r = getopt_led(pch);
+            pch = strtok(NULL, " ,");
+          }
+          if (pch != NULL)
+          {
+            leds_g = getopt_led(pch);
+            pch = strtok(NULL, " ,");
+          }
+          if (pch != NULL)
+          {
+            leds_b = getopt_led(pch);
+            pch = strtok(NULL, " ,");
+          }
+        }
+        break;
+      case CMD_BEEP:
+        cmd = CMD_BEEP;
+        break;
 
-    if (numDevicesToUse > 1)
-      msg("Working on RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
 
-    switch (cmd)
-    {
-      case CMD_LEDS :
-      case CMD_BEEP :
-      case CMD_VERSION :
+      case CMD_EEREAD :
+        cmd = CMD_EEREAD;
+        register_addr = htob(optarg);
+        if ((register_addr  == 0x00) || (register_addr  == 0xFF))
+        {
+          msg("Invalid register addr\n");
+          exit(EXIT_FAILURE);
+        }
         break;
 
-      default :
-        /* Check password */
+      case CMD_EEWRITE :
+        cmd = CMD_EEWRITE;
+        if (optarg != NULL)
         {
-          uint8_t buffer[2];
-          rc = rfidscan_RegisterRead(dev, 0x6F, buffer, sizeof(buffer));
-
-          if (rc > 0) 
+          char *pch = strtok( optarg, "=");
+          if (pch != NULL)
           {
-            if ((rc != 2) || ((buffer[0] == 0xFF) && (buffer[1] == 0xFF)))
-            {
-              msg("This RFID Scanner has been locked\n");
-              exit(EXIT_FAILURE);
-            }
-
-            if ((password[0] == 0xFF) && (password[1]))
+            register_addr = htob(optarg);
+            if ((register_addr  == 0x00) || (register_addr  == 0xFF))
             {
-              msg("This RFID Scanner is password-protected\n");
-              msg("Use the --password <password> option to login\n");
+              msg("Invalid register addr\n");
               exit(EXIT_FAILURE);
             }
-
-            if (memcmp(password, buffer, 2))
+            pch = strtok(NULL, "=");
+          }
+          if (pch != NULL)
+          {
+            rfidscan_register reg;
+            if (parse_value(register_addr, pch, &reg) < 0)
             {
-              msg("Wrong password\n");
+              msg("Invalid register value\n");
               exit(EXIT_FAILURE);
             }
-
-            msg("Password is OK!\n");
+            memcpy(register_data, reg.data, reg.size);
+            register_size = reg.size;
           }
         }
-    }
+        break;
 
-    switch (cmd)
-    {
-      case CMD_LEDS :
-        if (during_ms != 0)
-          rc = rfidscan_setLedsT(dev, leds_r, leds_g, leds_b, during_ms);
-        else
-          rc = rfidscan_setLedsP(dev, leds_r, leds_g, leds_b);
+      case CMD_EEDUMP :
+        cmd = CMD_EEDUMP;
         break;
-      case CMD_BEEP :
-        if (during_ms != 0)
-          rc = rfidscan_setBuzzer(dev, during_ms);
-        else
-          rc = rfidscan_setBuzzer(dev, 30);
+
+      case CMD_EEDUMP_ALL :
+        cmd = CMD_EEDUMP;
+        dump_all = 1;
         break;
-      case CMD_VERSION :
-        msg("Querying RFID Scanner with id:%d/%d\n", i+1, numDevicesToUse);
-        msg("\tVendorID    : %04X\n", rfidscan_getCachedVid(i));
-        msg("\tProductID   : %04X\n", rfidscan_getCachedPid(i));
-        rc = do_get_version(dev);
+
+      case CMD_EEFILE :
+        cmd = CMD_EEFILE;
+        config_file = optarg;
         break;
 
-      case CMD_TEST :
-        msg("Testing RFID Scanner width id:%d/%d\n", i+1, numDevicesToUse);
-        rc = do_test(dev);
+      case CMD_SNAPSHOT :
+        cmd = CMD_SNAPSHOT;
+        snapshot_file = optarg;
         break;
 
-      case CMD_EEDUMP :
-        rc = do_dump(dev);
+      case CMD_RESTORE :
+        cmd = CMD_RESTORE;
+        snapshot_file = optarg;
+        break;
+
+      case CMD_CHECKCONF :
+        cmd = CMD_CHECKCONF;
+        config_file = optarg;
         break;
 
       case CMD_LAYOUT :
-        msg("Setting new keyboard layout\n");
-        rc = do_write(dev, 0xA0, &layout, 1);
+        cmd = CMD_LAYOUT;
+        if (optarg != NULL)
+          layout = getopt_layout(optarg);
+        if (layout == 0xFF)
+        {
+          msg("Invalid keyboard layout\n");
+          exit(EXIT_FAILURE);
+        }
         break;
 
-      case CMD_EEREAD :
-        rc = do_read(dev, register_addr, 1);
+      case OPT_DURING:
+        if (optarg != NULL)
+          during_ms = (uint16_t) strtol(optarg,NULL,10);
         break;
 
-      case CMD_EEWRITE :
-        rc = do_write(dev, register_addr, register_data, register_size);
+      case OPT_PASSWORD:
+        if (optarg != NULL)
+          hstob(optarg, password, 2);
         break;
 
-      case CMD_EEFILE :
-        {
-          FILE *fp = NULL;
-          char buffer[512];
-          int general_section = 0;
-          int raw_section = 0;
+      case OPT_RESET :
+        reset++;
+        break;
+
+      case OPT_JOBS :
+        if (optarg != NULL)
+          jobs = strtol(optarg,NULL,10);
+        if (jobs < 1)
+          jobs = 1;
+        if (jobs > max_jobs)
+          jobs = max_jobs;
+        break;
+
+      case OPT_DAEMON :
+        daemon_socket = (optarg != NULL) ? optarg : "";
+        break;
+
+      case OPT_BACKEND :
+        backend = optarg;
+        break;
+
+      case OPT_SHOW_DIFF :
+        show_diff = 1;
+        break;
+
+      case OPT_SHADOW :
+        /* The password check and the commands then read the same registers once */
+        rfidscan_setRegisterShadow(1);
+        break;
 
-          fp = fopen(config_file, "rt");
-          if (fp == NULL)
+      case OPT_REGISTER_MAP :
+        {
+          uint8_t map[rfidscan_register_map_size];
+          if (rfidscan_parseRegisterMap(optarg, map) <= 0)
           {
-            msg("Failed to open the configuration file '%s'\n", config_file);
+            msg("Invalid register map\n");
             exit(EXIT_FAILURE);
           }
+          rfidscan_setRegisterMap(0, map);
+        }
+        break;
 
-          while (fgets(buffer, sizeof(buffer), fp))
-          {
-            strtok(buffer, "#;\r\n");
-
-            if (!stricmp(buffer, "[general]"))
-            {
-              raw_section = 0;
-              general_section = 1;
-            } else
-            if (!stricmp(buffer, "[raw]"))
-            {
-              general_section = 0;
-              raw_section = 1;
-            } else
-            if (buffer[0] == '[')
-            {
-              general_section = 0;
-              raw_section = 0;
-            } else
-            if (!stricmp(buffer, "erase=1") && (general_section || raw_section))
-            {
-              msg("Erasing previous values...\n");
-              for (register_addr = 0; register_addr < 0xFF; register_addr++)
-              {
-                rc = rfidscan_RegisterWrite(dev, register_addr, NULL, 0);
-                if (rc < 0)
-                  break;
-              }
-            } else
-            if (raw_section)
-            {
-              char *pch = strtok(buffer, "=");
-              if ((pch != NULL) && (strlen(pch) == 2))
-              {
-                register_addr = htob(pch);
-                if ((register_addr  == 0x00) || (register_addr  == 0xFF))
-                {
-                  msg("Invalid register addr\n");
-                  exit(EXIT_FAILURE);
-                }
-                pch = strtok(NULL, "=");
-                if (pch != NULL)
-                  register_size = hstob(pch, register_data, sizeof(register_data));
-                else
-                  register_size = 0;
-
-                rc = do_write(dev, register_addr, register_data, register_size);
-                if (rc < 0)
-                  break;
-              }
-            }
+      case OPT_QUIET:
+        if (optarg==NULL) quiet++;
+        else quiet = strtol(optarg,NULL,0);
+        break;
+      case OPT_VERBOSE:
+        if (optarg==NULL) rfidscan_verbose++;
+        else rfidscan_verbose = strtol(optarg,NULL,0);
+        if (rfidscan_verbose > 3)
+          fprintf(stderr,"going REALLY verbose\n");
+        break;
+      case OPT_DEVICE:
+        if( strcmp(optarg,"all") == 0 ) {
+          numDevicesToUse = 0; //rfidscan_max_devices;
+          for (i=0; i< rfidscan_max_devices; i++) {
+            deviceIds[i] = i;
+          }
+        } 
+        else { // if( strcmp(optarg,",") != -1 ) { // comma-separated list
+          char* pch;
+          int base = 0;
+          pch = strtok( optarg, " ,");
+          numDevicesToUse = 0;
+          while( pch != NULL && numDevicesToUse < rfidscan_max_devices ) { 
+            int base = (strlen(pch)==8) ? 16:0;
+            deviceIds[numDevicesToUse++] = strtol(pch,NULL,base);
+            pch = strtok(NULL, " ,");
+          }
+          for (i=0; i<numDevicesToUse; i++) { 
+            printf("deviceId[%d]: %d\n", i, deviceIds[i]);
           }
-
-          fclose(fp);
         }
         break;
 
+      case CMD_HELP:
+        usage("rfidscan-tool");
+        exit(EXIT_FAILURE);
+        break;
+
       default :
-        msg("Internal error\n");
+        msg("Error while parsing the args\n");
         exit(EXIT_FAILURE);
     }
+  }
+
+  if (cmd == CMD_NONE)
+  {
+    usage("rfidscan-tool");
+    exit(EXIT_FAILURE);
+  }
+
+  if (daemon_socket != NULL)
+  {
+#ifndef WIN32
+    if (run_daemon_client(daemon_socket, deviceIds, numDevicesToUse) < 0)
+      exit(EXIT_FAILURE);
+    exit(EXIT_SUCCESS);
+#else
+    msg("rfidscand is not available on this platform\n");
+    exit(EXIT_FAILURE);
+#endif
+  }
+
+  if (backend != NULL && rfidscan_setBackend(backend) < 0)
+  {
+    msg("Backend %s is not available\n", backend);
+    exit(EXIT_FAILURE);
+  }
 
-    if (reset && (rc >= 0))
+  /* Get a list of all devices and their paths */
+  countDevices = rfidscan_enumerate();
+  if (countDevices == 0)
+  {
+    msg("No RFID Scanner found\n");
+    exit(EXIT_FAILURE);
+  }
+
+  msg("%d RFID Scanner(s) found\n", countDevices);
+
+  if (cmd == CMD_LIST)
+  {
+    for (i=0; i<countDevices; i++)
     {
-      msg("Applying the new settings...\n");
-      rc = rfidscan_ApplyConfig(dev);
+      printf("id:%d - VID: %04X, PID: %04X, serial number: %s\n", i, rfidscan_getCachedVid(i), rfidscan_getCachedPid(i), rfidscan_getCachedSerial(i));
     }
 
-    if (rc < 0)
-    {
-      msg("An error has occured\n");
+    exit(EXIT_SUCCESS);
+  }
+
+  if (countDevices > rfidscan_max_devices)
+    countDevices = rfidscan_max_devices;
+
+  if (numDevicesToUse == 0)
+  {
+    for (i=0; i<countDevices; i++)
+      deviceIds[i] = i;
+    numDevicesToUse = countDevices;
+  }
+
+  if (((cmd == CMD_EEFILE) || (cmd == CMD_CHECKCONF)) && (load_conf(config_file) < 0))
+    exit(EXIT_FAILURE);
+
+  if ((cmd == CMD_RESTORE) && (load_snapshot(snapshot_file) < 0))
+    exit(EXIT_FAILURE);
+
+  if ((cmd == CMD_SNAPSHOT) && (numDevicesToUse > 1) && (strstr(snapshot_file, "%s") == NULL))
+  {
+    msg("Put %%s in the snapshot file name, to save a file per RFID Scanner\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i=0; i<numDevicesToUse; i++)
+  {
+    job_list[i].index = i;
+    job_list[i].id = deviceIds[i];
+    job_list[i].out = NULL;
+    job_list[i].rc = 0;
+  }
+  job_count = numDevicesToUse;
+
+  if ((jobs > 1) && (job_count > 1))
+  {
+    if (run_parallel())
       exit(EXIT_FAILURE);
+  } else
+  {
+    for (i=0; i<job_count; i++)
+    {
+      job_list[i].rc = run_device(&job_list[i]);
+      if (job_list[i].rc < 0)
+        exit(EXIT_FAILURE);
     }
+  }
 
-    rfidscan_close(dev);
+  /* --check-conf found some RFID Scanners different */
+  for (i=0; (i<job_count) && (cmd == CMD_CHECKCONF); i++)
+  {
+    if (job_list[i].rc > 0)
+      exit(EXIT_FAILURE);
   }
 
   exit(EXIT_SUCCESS);
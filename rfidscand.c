@@ -0,0 +1,650 @@
+/*
+* rfidscand -- keeps the RFID Scanners open and serves the requests of
+* "rfidscan-tool --daemon" over a Unix domain socket, see rfidscand.h
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <grp.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "rfidscan-lib.h"
+#include "rfidscand.h"
+
+#define max_clients 32
+
+static const char *socket_path = NULL;
+static char user_socket[PATH_MAX];
+static gid_t socket_group = (gid_t) -1;  // -g: group allowed to connect
+static volatile sig_atomic_t stopping = 0;
+
+// a connected client, and the request being received
+typedef struct {
+  int fd;
+  int len;
+  uint8_t buf[RFIDSCAND_REQUEST_HEADER + RFIDSCAND_REQUEST_MAX];
+} client;
+
+static client clients[max_clients];
+static int client_count = 0;
+
+static uint8_t answer[RFIDSCAND_ANSWER_HEADER + RFIDSCAND_ANSWER_MAX];
+
+// printf to stderr, when verbose
+static void log_msg(char* fmt, ...)
+{
+  va_list args;
+  va_start(args,fmt);
+  if (rfidscan_verbose)
+    vfprintf(stderr, fmt, args);
+  va_end(args);
+}
+
+// ---------------------------------------------------------------------------
+//
+// check the password like rfidscan-tool does, rfidscan_reg_password being read
+// from the register shadow once it has been read, with --shadow
+static int check_password(rfidscan_device *dev, const uint8_t password[2])
+{
+  uint8_t value[2];
+  int rc;
+
+  rc = rfidscan_RegisterRead(dev, rfidscan_reg_password, value, sizeof(value));
+  if (rc < 0)
+    return RFIDSCAND_ERROR;
+
+  if (rc > 0)
+  {
+    if ((rc != 2) || ((value[0] == 0xFF) && (value[1] == 0xFF)))
+      return RFIDSCAND_LOCKED;
+
+    if ((password[0] == 0xFF) && (password[1]))
+      return RFIDSCAND_PASSWORD_REQUIRED;
+
+    if (memcmp(password, value, 2))
+      return RFIDSCAND_WRONG_PASSWORD;
+  }
+
+  return RFIDSCAND_OK;
+}
+
+// readers are kept open by rfidscan_setKeepOpen(), opening is immediate
+static rfidscan_device *open_reader(uint32_t id)
+{
+  rfidscan_device *dev = rfidscan_openById(id);
+
+  if (dev == NULL)
+  {
+    /* Plugged in since the last enumeration, when hotplug is not there */
+    rfidscan_enumerate();
+    dev = rfidscan_openById(id);
+  }
+
+  return dev;
+}
+
+// append a NUL-terminated string to the answer
+static int put_string(uint8_t *p, const char *str)
+{
+  int len = strlen(str) + 1;
+  memcpy(p, str, len);
+  return len;
+}
+
+// ---------------------------------------------------------------------------
+// serve one request, the payload of the answer is written to data
+static int handle_request(const uint8_t *req, uint8_t *data, int *size)
+{
+  uint8_t op = req[0];
+  int len = rfidscand_get16(&req[1]);
+  uint32_t id = rfidscand_get32(&req[3]);
+  const uint8_t *password = &req[7];
+  const uint8_t *payload = &req[RFIDSCAND_REQUEST_HEADER];
+  rfidscan_device *dev;
+  int i, rc, status = RFIDSCAND_OK;
+
+  *size = 0;
+
+  if (op == RFIDSCAND_OP_LIST)
+  {
+    for (i=0; i<rfidscan_getCachedCount(); i++)
+    {
+      const char *serial = rfidscan_getCachedSerial(i);
+      rfidscand_put16(&data[*size], rfidscan_getCachedVid(i));
+      rfidscand_put16(&data[*size + 2], rfidscan_getCachedPid(i));
+      *size += 4;
+      *size += put_string(&data[*size], serial ? serial : "");
+    }
+    return RFIDSCAND_OK;
+  }
+
+  dev = open_reader(id);
+  if (dev == NULL)
+    return RFIDSCAND_NO_DEVICE;
+
+  switch (op)
+  {
+    case RFIDSCAND_OP_LEDS :
+    case RFIDSCAND_OP_BEEP :
+    case RFIDSCAND_OP_VERSION :
+      break;
+
+    default :
+      status = check_password(dev, password);
+  }
+
+  if (status == RFIDSCAND_OK)
+  {
+    switch (op)
+    {
+      case RFIDSCAND_OP_LEDS :
+        if (len != 5)
+        {
+          status = RFIDSCAND_BAD_REQUEST;
+          break;
+        }
+        if (rfidscand_get16(&payload[3]) != 0)
+          rc = rfidscan_setLedsT(dev, payload[0], payload[1], payload[2], rfidscand_get16(&payload[3]));
+        else
+          rc = rfidscan_setLedsP(dev, payload[0], payload[1], payload[2]);
+        if (rc < 0)
+          status = RFIDSCAND_ERROR;
+        break;
+
+      case RFIDSCAND_OP_BEEP :
+        if (len != 2)
+        {
+          status = RFIDSCAND_BAD_REQUEST;
+          break;
+        }
+        if (rfidscan_setBuzzer(dev, rfidscand_get16(payload)) < 0)
+          status = RFIDSCAND_ERROR;
+        break;
+
+      case RFIDSCAND_OP_READ :
+        if (len != 1)
+        {
+          status = RFIDSCAND_BAD_REQUEST;
+          break;
+        }
+        rc = rfidscan_RegisterRead(dev, payload[0], data, rfidscan_register_max);
+        if (rc < 0)
+          status = RFIDSCAND_ERROR;
+        else
+          *size = rc;
+        break;
+
+      case RFIDSCAND_OP_WRITE :
+        {
+          rfidscan_register reg, readback;
+
+          if ((len < 1) || (len > 1 + rfidscan_register_max))
+          {
+            status = RFIDSCAND_BAD_REQUEST;
+            break;
+          }
+          reg.addr = payload[0];
+          reg.size = len - 1;
+          memcpy(reg.data, &payload[1], reg.size);
+          readback.size = 0;
+
+          rc = rfidscan_RegisterWriteMany(dev, &reg, 1, &readback, 0);
+          if (rc < 0)
+            status = RFIDSCAND_ERROR;
+          else
+          if (rc > 0)
+            status = RFIDSCAND_WRITE_FAILED;
+          if (readback.size > 0)
+          {
+            memcpy(data, readback.data, readback.size);
+            *size = readback.size;
+          }
+        }
+        break;
+
+      case RFIDSCAND_OP_DUMP :
+        {
+          rfidscan_register regs[254];
+          uint8_t map[rfidscan_register_map_size];
+
+          if (rfidscan_getRegisterMap(dev, map) == 0)
+            rc = rfidscan_RegisterReadMap(dev, map, regs);
+          else
+            rc = rfidscan_RegisterReadRange(dev, 1, 254, regs);
+          if (rc < 0)
+          {
+            status = RFIDSCAND_ERROR;
+            break;
+          }
+          for (i=0; i<rc; i++)
+          {
+            if (regs[i].size < 0)
+            {
+              status = RFIDSCAND_ERROR;
+              break;
+            }
+            if (regs[i].size == 0)
+              continue;
+            data[*size] = regs[i].addr;
+            data[*size + 1] = (uint8_t) regs[i].size;
+            memcpy(&data[*size + 2], regs[i].data, regs[i].size);
+            *size += 2 + regs[i].size;
+          }
+        }
+        break;
+
+      case RFIDSCAND_OP_VERSION :
+        {
+          char str[64];
+          int idx = rfidscan_getCacheIndexByDev(dev);
+
+          rfidscand_put16(&data[0], rfidscan_getCachedVid(idx));
+          rfidscand_put16(&data[2], rfidscan_getCachedPid(idx));
+          *size = 4;
+
+          status = RFIDSCAND_ERROR;
+          if (rfidscan_getVendorName(dev, str, sizeof(str)) < 0)
+            break;
+          *size += put_string(&data[*size], str);
+          if (rfidscan_getProductName(dev, str, sizeof(str)) < 0)
+            break;
+          *size += put_string(&data[*size], str);
+          if (rfidscan_getSerialNumber(dev, str, sizeof(str)) < 0)
+            break;
+          *size += put_string(&data[*size], str);
+          if (rfidscan_getVersion(dev, str, sizeof(str)) < 0)
+            break;
+          *size += put_string(&data[*size], str);
+          status = RFIDSCAND_OK;
+        }
+        break;
+
+      default :
+        status = RFIDSCAND_BAD_REQUEST;
+    }
+  }
+
+  rfidscan_close(dev);
+
+  return status;
+}
+
+// ---------------------------------------------------------------------------
+//
+static void drop_client(int c)
+{
+  close(clients[c].fd);
+  clients[c] = clients[--client_count];
+}
+
+static int write_full(int fd, const uint8_t *data, int len)
+{
+  int rc;
+
+  while (len > 0)
+  {
+    rc = write(fd, data, len);
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return -1;
+    data += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+// read what the client sent, answer once the request is complete
+static void serve_client(int c)
+{
+  client *cl = &clients[c];
+  int need = RFIDSCAND_REQUEST_HEADER;
+  int rc, size;
+  uint8_t status;
+
+  if (cl->len >= RFIDSCAND_REQUEST_HEADER)
+    need += rfidscand_get16(&cl->buf[1]);
+
+  rc = read(cl->fd, &cl->buf[cl->len], need - cl->len);
+  if (rc <= 0)
+  {
+    if (rc < 0 && errno == EINTR)
+      return;
+    drop_client(c);
+    return;
+  }
+  cl->len += rc;
+
+  if (cl->len == RFIDSCAND_REQUEST_HEADER)
+  {
+    if (rfidscand_get16(&cl->buf[1]) > RFIDSCAND_REQUEST_MAX)
+    {
+      drop_client(c);
+      return;
+    }
+    need += rfidscand_get16(&cl->buf[1]);
+  }
+  if (cl->len < need)
+    return;
+
+  status = handle_request(cl->buf, &answer[RFIDSCAND_ANSWER_HEADER], &size);
+  log_msg("rfidscand: op %d on id %u: status %d, %d bytes\n",
+    cl->buf[0], rfidscand_get32(&cl->buf[3]), status, size);
+
+  answer[0] = status;
+  rfidscand_put16(&answer[1], size);
+  cl->len = 0;
+  if (write_full(cl->fd, answer, RFIDSCAND_ANSWER_HEADER + size) < 0)
+    drop_client(c);
+}
+
+// ---------------------------------------------------------------------------
+// keep the readers open as they are plugged in
+static void hotplug(int event, const char *serial, void *user_data)
+{
+  rfidscan_device *dev;
+
+  log_msg("rfidscand: %s %s\n", (event == rfidscan_hotplug_arrived) ? "arrived" : "left", serial);
+
+  if (event == rfidscan_hotplug_arrived)
+  {
+    dev = rfidscan_openBySerial(serial);
+    if (dev != NULL)
+      rfidscan_close(dev);
+  }
+}
+
+static void on_signal(int sig)
+{
+  stopping = 1;
+}
+
+// RFIDSCAND_SOCKET for root, which creates its directory, or
+// RFIDSCAND_USER_SOCKET in $XDG_RUNTIME_DIR for a user
+static const char *default_socket(void)
+{
+  const char *dir;
+
+  if (geteuid() == 0)
+  {
+    if ((mkdir("/run/rfidscand", 0755) < 0) && (errno != EEXIST))
+      return NULL;
+    return RFIDSCAND_SOCKET;
+  }
+
+  dir = getenv("XDG_RUNTIME_DIR");
+  if ((dir == NULL) || (dir[0] == '\0'))
+  {
+    errno = ENOENT;
+    return NULL;
+  }
+  snprintf(user_socket, sizeof(user_socket), "%s/" RFIDSCAND_USER_SOCKET, dir);
+  return user_socket;
+}
+
+// the socket is only bound in a directory owned by root or by us, that
+// nobody else can write to: otherwise another user could replace it and
+// receive the passwords sent by the clients
+static int check_socket_dir(const char *path)
+{
+  char dir[PATH_MAX];
+  char *slash;
+  struct stat st;
+
+  snprintf(dir, sizeof(dir), "%s", path);
+  slash = strrchr(dir, '/');
+  if (slash == NULL)
+    strcpy(dir, ".");
+  else if (slash == dir)
+    dir[1] = '\0';
+  else
+    *slash = '\0';
+
+  if (lstat(dir, &st) < 0)
+    return -1;
+  if (!S_ISDIR(st.st_mode) ||
+      ((st.st_uid != 0) && (st.st_uid != geteuid())) ||
+      (st.st_mode & (S_IWGRP | S_IWOTH)))
+  {
+    fprintf(stderr, "rfidscand: %s may be written by other users\n", dir);
+    errno = EPERM;
+    return -1;
+  }
+  return 0;
+}
+
+static int open_socket(void)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if (check_socket_dir(socket_path) < 0)
+    return -1;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+  unlink(socket_path);
+  if ((bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+      ((socket_group != (gid_t) -1) && (chown(socket_path, (uid_t) -1, socket_group) < 0)) ||
+      (chmod(socket_path, 0660) < 0) ||
+      (listen(fd, 8) < 0))
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// ---------------------------------------------------------------------------
+//
+static void usage(char *myName)
+{
+  fprintf(stderr,
+    "Usage: \n"
+    "  %s [options]\n"
+    "\n"
+    "Keeps the RFID Scanner(s) open and serves \"rfidscan-tool --daemon\"\n"
+    "\n"
+    "where [options] are: \n"
+    "  -s, --socket <path>  Listen on this socket (default " RFIDSCAND_SOCKET ",\n"
+    "                       $XDG_RUNTIME_DIR/" RFIDSCAND_USER_SOCKET " if not run as root)\n"
+    "  -g, --group <group>  Let the members of this group connect (by default\n"
+    "                       only the group of the daemon can)\n"
+    "  -f, --foreground     Do not detach from the terminal\n"
+    "  -S, --shadow         Serve the registers read again from memory, for a\n"
+    "                       reader nothing else writes to\n"
+    "  -m, --register-map <addrs>\n"
+    "                       Dump only these registers, e.g. 10-1F,6F,A0\n"
+    "  -v, --verbose        Verbose debugging msgs\n"
+    "\n"
+    ,myName);
+}
+
+//
+int main(int argc, char** argv)
+{
+  struct pollfd fds[2 + max_clients];
+  struct timeval timeout = { 1, 0 };
+  int listen_fd, event_fd;
+  int foreground = 0;
+  uint8_t map[rfidscan_register_map_size];
+  int i, n, first, count;
+  rfidscan_device *dev;
+
+  int option_value, option_index = 0;
+  static struct option option_list[] = {
+    {"help",         no_argument,       0,      '?'},
+    {"socket",       required_argument, 0,      's'},
+    {"group",        required_argument, 0,      'g'},
+    {"foreground",   no_argument,       0,      'f'},
+    {"shadow",       no_argument,       0,      'S'},
+    {"register-map", required_argument, 0,      'm'},
+    {"verbose",      no_argument,       0,      'v'},
+    {NULL,           0,                 0,      0}
+  };
+
+  while ((option_value = getopt_long(argc, argv, "s:g:fSm:v?", option_list, &option_index)) != -1)
+  {
+    switch (option_value)
+    {
+      case 's':
+        socket_path = optarg;
+        break;
+      case 'g':
+        {
+          struct group *gr = getgrnam(optarg);
+          if (gr == NULL)
+          {
+            fprintf(stderr, "rfidscand: unknown group %s\n", optarg);
+            exit(EXIT_FAILURE);
+          }
+          socket_group = gr->gr_gid;
+        }
+        break;
+      case 'f':
+        foreground = 1;
+        break;
+      case 'S':
+        rfidscan_setRegisterShadow(1);
+        break;
+      case 'm':
+        if (rfidscan_parseRegisterMap(optarg, map) <= 0)
+        {
+          fprintf(stderr, "rfidscand: invalid register map %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        rfidscan_setRegisterMap(0, map);
+        break;
+      case 'v':
+        rfidscan_verbose++;
+        break;
+      default:
+        usage("rfidscand");
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  if (socket_path == NULL)
+    socket_path = default_socket();
+  if (socket_path == NULL)
+  {
+    fprintf(stderr, "rfidscand: no socket directory (XDG_RUNTIME_DIR unset?), use --socket: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  listen_fd = open_socket();
+  if (listen_fd < 0)
+  {
+    fprintf(stderr, "rfidscand: can't listen on %s: %s\n", socket_path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  if (!foreground && (daemon(0, 0) < 0))
+  {
+    fprintf(stderr, "rfidscand: can't detach: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  /* Open every reader once, they then stay open */
+  rfidscan_setKeepOpen(1);
+  count = rfidscan_enumerate();
+  for (i=0; i<count; i++)
+  {
+    dev = rfidscan_openById(i);
+    if (dev != NULL)
+      rfidscan_close(dev);
+  }
+  log_msg("rfidscand: %d RFID Scanner(s) found\n", count);
+
+  if (rfidscan_hotplugRegister(hotplug, NULL) < 0)
+    log_msg("rfidscand: no hotplug, new readers are found on request\n");
+  event_fd = rfidscan_getEventFd();
+
+  while (!stopping)
+  {
+    n = 0;
+    fds[n].fd = listen_fd;
+    fds[n++].events = POLLIN;
+    if (event_fd >= 0)
+    {
+      fds[n].fd = event_fd;
+      fds[n++].events = POLLIN;
+    }
+    for (i=0; i<client_count; i++)
+    {
+      fds[n].fd = clients[i].fd;
+      fds[n++].events = POLLIN;
+    }
+
+    if (poll(fds, n, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    /* Clients first, from the last so that drop_client() does not move
+       one not served yet. Their slots start at first: client_count goes
+       down as they are dropped */
+    first = n - client_count;
+    for (i=client_count-1; i>=0; i--)
+    {
+      if (fds[first + i].revents)
+        serve_client(i);
+    }
+
+    if ((event_fd >= 0) && fds[1].revents)
+      rfidscan_handleEvents(0);
+
+    if (fds[0].revents & POLLIN)
+    {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0)
+      {
+        if (client_count == max_clients)
+        {
+          close(fd);
+        } else
+        {
+          fcntl(fd, F_SETFD, FD_CLOEXEC);
+          setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+          clients[client_count].fd = fd;
+          clients[client_count].len = 0;
+          client_count++;
+        }
+      }
+    }
+  }
+
+  rfidscan_hotplugDeregister();
+  rfidscan_setKeepOpen(0);
+  close(listen_fd);
+  unlink(socket_path);
+
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,65 @@
+/**
+ * rfidscand -- resident daemon keeping the RFID Scanners open
+ *
+ * rfidscand enumerates the readers once, keeps them open and serves the
+ * requests of "rfidscan-tool --daemon" over a Unix domain socket, so that
+ * a request costs a round trip on the socket plus the USB work only.
+ *
+ * Wire protocol, all integers big-endian:
+ *
+ *   request:  op(1) len(2) id(4) password(2) payload(len)
+ *   answer:   status(1) len(2) payload(len)
+ *
+ * id selects the reader as rfidscan_openById() does: an index in the list
+ * of readers, or the serial number as a number. password is sent for the
+ * commands that need it, FFFF when none was given.
+ *
+ * As the password goes over the socket, the socket only lives in a
+ * directory that nobody else can write to: RFIDSCAND_SOCKET for a daemon
+ * run by root, RFIDSCAND_USER_SOCKET in $XDG_RUNTIME_DIR for a daemon run
+ * by a user. The socket is read-write for the group given by --group, the
+ * group of the daemon otherwise. The client only talks to a daemon run by
+ * root or by itself.
+ *
+ */
+
+#ifndef __RFIDSCAND_H__
+#define __RFIDSCAND_H__
+
+#define RFIDSCAND_SOCKET      "/run/rfidscand/rfidscand.sock"
+#define RFIDSCAND_USER_SOCKET "rfidscand.sock"  /**< in $XDG_RUNTIME_DIR */
+
+#define RFIDSCAND_REQUEST_HEADER 9
+#define RFIDSCAND_ANSWER_HEADER  3
+#define RFIDSCAND_REQUEST_MAX    255    /**< longest request payload */
+#define RFIDSCAND_ANSWER_MAX     65535  /**< longest answer payload */
+
+/** requests, with their payload -> the payload of the answer */
+enum {
+  RFIDSCAND_OP_LIST = 1,  /**< -> vid(2) pid(2) serial NUL, for each reader */
+  RFIDSCAND_OP_LEDS,      /**< r(1) g(1) b(1) during_ms(2), 0 to keep them */
+  RFIDSCAND_OP_BEEP,      /**< during_ms(2) */
+  RFIDSCAND_OP_READ,      /**< addr(1) -> value */
+  RFIDSCAND_OP_WRITE,     /**< addr(1) value -> value read back */
+  RFIDSCAND_OP_DUMP,      /**< -> addr(1) size(1) value, for each register set */
+  RFIDSCAND_OP_VERSION,   /**< -> vid(2) pid(2) vendor NUL product NUL serial NUL version NUL */
+};
+
+/** status of an answer */
+enum {
+  RFIDSCAND_OK = 0,
+  RFIDSCAND_ERROR,              /**< the reader did not answer as expected */
+  RFIDSCAND_NO_DEVICE,          /**< no reader with this id */
+  RFIDSCAND_LOCKED,             /**< the reader has been locked */
+  RFIDSCAND_PASSWORD_REQUIRED,  /**< the reader is password-protected */
+  RFIDSCAND_WRONG_PASSWORD,
+  RFIDSCAND_WRITE_FAILED,       /**< the value read back is not the one written */
+  RFIDSCAND_BAD_REQUEST,
+};
+
+#define rfidscand_put16(p, v) ((p)[0] = (uint8_t) ((v) >> 8), (p)[1] = (uint8_t) (v))
+#define rfidscand_put32(p, v) (rfidscand_put16((p), (v) >> 16), rfidscand_put16((p) + 2, (v)))
+#define rfidscand_get16(p) ((uint16_t) (((p)[0] << 8) | (p)[1]))
+#define rfidscand_get32(p) (((uint32_t) rfidscand_get16(p) << 16) | rfidscand_get16((p) + 2))
+
+#endif